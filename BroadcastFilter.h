@@ -0,0 +1,300 @@
+/*
+ * The MIT License (MIT)
+ * Copyright (c) 2014 Rei <devel@reixd.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __BROADCASTFILTER_H__
+#define __BROADCASTFILTER_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <iostream>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#define BC_ANY -1 /**< Wildcard for the fields of a BroadcastRule */
+
+#define ETH_HDR_LEN 14
+#define ETH_TYPE_IPV4 0x0800
+#define ETH_TYPE_ARP 0x0806
+#define ETH_TYPE_IPV6 0x86DD
+#define IP_PROTO_ICMPV6 58
+#define IP_PROTO_TCP 6
+#define IP_PROTO_UDP 17
+
+/**
+* A drop rule for broadcast/multicast frames coming from the TUN/TAP interface.
+*
+* For UDP and TCP the port is matched against the destination port, for ICMPv6 against the message type.
+*/
+struct BroadcastRule {
+    int etherType;  /**< Ethernet type (e.g. 0x0800) or BC_ANY */
+    int ipProto;  /**< IP protocol number (e.g. 17 for UDP) or BC_ANY */
+    int port;  /**< Destination port, ICMPv6 type or BC_ANY */
+};
+
+/**
+* This class decides which broadcast/multicast frames from the TUN/TAP interface are worth sending over the air.
+*
+* A frame passes four stages in order:
+*  - the drop rules (protocols we never want on the radio, e.g. mDNS or SSDP)
+*  - multicast frames which are not a full broadcast are dropped, if enabled
+*  - a deduplication window which drops identical frames seen shortly before
+*  - a token bucket limiting the remaining broadcast rate
+*
+* Unicast frames are always accepted. The class is thread safe.
+*/
+class BroadcastFilter {
+  public:
+    BroadcastFilter() :
+        dedupWindowMs_(1000),
+        rate_(10),
+        burst_(20),
+        tokens_(20),
+        lastRefillMs_(0),
+        dropMulticast_(true),
+        dedupNext_(0),
+        droppedByRule_(0),
+        droppedAsMulticast_(0),
+        droppedAsDuplicate_(0),
+        droppedByRate_(0),
+        accepted_(0) {
+        dedup_.resize(16);
+    };
+
+    /**
+    * Add a rule for frames which are never forwarded to the radio.
+    * @param etherType Ethernet type or BC_ANY
+    * @param ipProto IP protocol number or BC_ANY
+    * @param port Destination port, ICMPv6 type or BC_ANY
+    */
+    void addDropRule(int etherType, int ipProto, int port) {
+        BroadcastRule rule = {etherType, ipProto, port};
+        addDropRule(rule);
+    };
+
+    /**
+    * Add a rule for frames which are never forwarded to the radio.
+    * @param rule The rule
+    */
+    void addDropRule(const BroadcastRule &rule) {
+        boost::lock_guard<boost::mutex> l(m_);
+        rules_.push_back(rule);
+    };
+
+    /**
+    * Remove all the drop rules.
+    */
+    void clearRules() {
+        boost::lock_guard<boost::mutex> l(m_);
+        rules_.clear();
+    };
+
+    /**
+    * Set the deduplication window. Identical frames within this window are dropped.
+    * @param windowMs The window in milliseconds, 0 disables the deduplication
+    */
+    void setDedupWindow(uint32_t windowMs) {
+        boost::lock_guard<boost::mutex> l(m_);
+        dedupWindowMs_ = windowMs;
+    };
+
+    /**
+    * Configure the token bucket for broadcast frames.
+    * @param rate Frames per second, 0 disables the rate limit
+    * @param burst Maximal number of frames sent back to back
+    */
+    void setRateLimit(uint32_t rate, uint32_t burst) {
+        boost::lock_guard<boost::mutex> l(m_);
+        rate_ = rate;
+        burst_ = burst;
+        tokens_ = burst;
+    };
+
+    /**
+    * Drop multicast frames which are not a full broadcast (01:00:5e:.., 33:33:..).
+    * If they are not dropped they are multicast over the air like broadcasts.
+    * @param drop True to drop them
+    */
+    void setDropMulticast(bool drop) {
+        boost::lock_guard<boost::mutex> l(m_);
+        dropMulticast_ = drop;
+    };
+
+    /**
+    * Decide if the frame should be sent over the air.
+    * @param frame The ethernet frame
+    * @param len The length of the frame
+    * @param nowMs A monotonic timestamp in milliseconds
+    * @return True if the frame should be forwarded to the radio
+    */
+    bool accept(const uint8_t *frame, std::size_t len, uint64_t nowMs) {
+        // an RF24 MAC carries the node address in the first bytes, an odd address sets the group bit
+        if (len < ETH_HDR_LEN || !(frame[0] & 0x01) || memcmp(frame + 2, "RF24", 4) == 0) {
+            return true; // unicast
+        }
+
+        boost::lock_guard<boost::mutex> l(m_);
+
+        if (matchesRule(frame, len)) {
+            droppedByRule_++;
+            return false;
+        }
+
+        bool broadcast = true;
+        for (int i = 0; i < 6; i++) {
+            broadcast = broadcast && frame[i] == 0xFF;
+        }
+        if (!broadcast && dropMulticast_) {
+            droppedAsMulticast_++;
+            return false;
+        }
+
+        uint32_t hash = 0;
+        if (dedupWindowMs_ > 0) {
+            hash = fnv1a(frame, len);
+            for (std::size_t i = 0; i < dedup_.size(); i++) {
+                if (dedup_[i].hash == hash && dedup_[i].len == len &&
+                    dedup_[i].seenMs + dedupWindowMs_ > nowMs && dedup_[i].seenMs != 0) {
+                    droppedAsDuplicate_++;
+                    return false;
+                }
+            }
+        }
+
+        if (rate_ > 0) {
+            if (nowMs > lastRefillMs_) {
+                uint64_t refill = (nowMs - lastRefillMs_) * rate_ / 1000;
+                if (tokens_ + refill >= burst_) {
+                    tokens_ = burst_;
+                    lastRefillMs_ = nowMs;
+                } else if (refill > 0) {
+                    // keep the fraction of the next token
+                    tokens_ += refill;
+                    lastRefillMs_ += refill * 1000 / rate_;
+                }
+            }
+            if (tokens_ == 0) {
+                droppedByRate_++;
+                return false;
+            }
+            tokens_--;
+        }
+
+        // only what goes on air suppresses a retry
+        if (dedupWindowMs_ > 0) {
+            dedup_[dedupNext_].hash = hash;
+            dedup_[dedupNext_].len = len;
+            dedup_[dedupNext_].seenMs = nowMs;
+            dedupNext_ = (dedupNext_ + 1) % dedup_.size();
+        }
+
+        accepted_++;
+        return true;
+    };
+
+    /**
+    * Print the filter statistics to stdout.
+    */
+    void printStats() {
+        boost::lock_guard<boost::mutex> l(m_);
+        std::cout << "Broadcast filter: accepted " << accepted_
+                  << ", dropped by rule " << droppedByRule_
+                  << ", multicast " << droppedAsMulticast_
+                  << ", duplicates " << droppedAsDuplicate_
+                  << ", rate limited " << droppedByRate_ << std::endl;
+    };
+
+  private:
+    struct DedupEntry {
+        DedupEntry() : hash(0), len(0), seenMs(0) {};
+        uint32_t hash;
+        std::size_t len;
+        uint64_t seenMs;
+    };
+
+    bool matchesRule(const uint8_t *frame, std::size_t len) {
+        int etherType = (frame[12] << 8) | frame[13];
+        int ipProto = BC_ANY;
+        int port = BC_ANY;
+        const uint8_t *l4 = NULL;
+
+        if (etherType == ETH_TYPE_IPV4 && len >= ETH_HDR_LEN + 20) {
+            const uint8_t *ip = frame + ETH_HDR_LEN;
+            std::size_t ihl = (ip[0] & 0x0F) * 4;
+            ipProto = ip[9];
+            if (len >= ETH_HDR_LEN + ihl + 4) {
+                l4 = ip + ihl;
+            }
+        } else if (etherType == ETH_TYPE_IPV6 && len >= ETH_HDR_LEN + 40 + 4) {
+            const uint8_t *ip = frame + ETH_HDR_LEN;
+            ipProto = ip[6];
+            l4 = ip + 40;
+        }
+
+        if (l4 != NULL) {
+            if (ipProto == IP_PROTO_UDP || ipProto == IP_PROTO_TCP) {
+                port = (l4[2] << 8) | l4[3];
+            } else if (ipProto == IP_PROTO_ICMPV6) {
+                port = l4[0];
+            }
+        }
+
+        for (std::size_t i = 0; i < rules_.size(); i++) {
+            const BroadcastRule &r = rules_[i];
+            if ((r.etherType == BC_ANY || r.etherType == etherType) &&
+                (r.ipProto == BC_ANY || r.ipProto == ipProto) &&
+                (r.port == BC_ANY || r.port == port)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    static uint32_t fnv1a(const uint8_t *data, std::size_t len) {
+        uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < len; i++) {
+            hash ^= data[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    };
+
+    boost::mutex m_;
+    std::vector<BroadcastRule> rules_;  /**< Frames matching one of these rules are dropped */
+    std::vector<DedupEntry> dedup_;  /**< Ring of the recently accepted broadcasts */
+    uint32_t dedupWindowMs_;  /**< Deduplication window in milliseconds */
+    uint32_t rate_;  /**< Token bucket refill rate in frames per second */
+    uint32_t burst_;  /**< Token bucket size */
+    uint64_t tokens_;  /**< Available tokens */
+    uint64_t lastRefillMs_;  /**< Time of the last token refill */
+    bool dropMulticast_;  /**< Drop non broadcast multicast frames */
+    std::size_t dedupNext_;  /**< Next slot to overwrite in the dedup ring */
+    unsigned long droppedByRule_;
+    unsigned long droppedAsMulticast_;
+    unsigned long droppedAsDuplicate_;
+    unsigned long droppedByRate_;
+    unsigned long accepted_;
+};
+
+#endif // __BROADCASTFILTER_H__
@@ -0,0 +1,561 @@
+/*
+ * The MIT License (MIT)
+ * Copyright (c) 2014 Rei <devel@reixd.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __GSOOFFLOAD_H__
+#define __GSOOFFLOAD_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <arpa/inet.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+#endif
+#include "Message.h"
+#include "BroadcastFilter.h"
+
+/**
+* The virtio net header preceding every packet on a TUN/TAP device opened with IFF_VNET_HDR.
+* Same layout as struct virtio_net_hdr in linux/virtio_net.h, which does not compile as C++ on newer kernels.
+*/
+struct virtio_net_hdr {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;  /**< Ethernet + IP + TCP/UDP headers */
+    uint16_t gso_size;  /**< Bytes to append to hdr_len per frame */
+    uint16_t csum_start;  /**< Position to start checksumming from */
+    uint16_t csum_offset;  /**< Offset after that to place checksum */
+};
+
+#ifndef VIRTIO_NET_HDR_F_NEEDS_CSUM
+    #define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+    #define VIRTIO_NET_HDR_F_DATA_VALID 2
+    #define VIRTIO_NET_HDR_GSO_NONE 0
+    #define VIRTIO_NET_HDR_GSO_TCPV4 1
+    #define VIRTIO_NET_HDR_GSO_UDP 3
+    #define VIRTIO_NET_HDR_GSO_TCPV6 4
+    #define VIRTIO_NET_HDR_GSO_ECN 0x80
+#endif
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_PSH 0x08
+#define TCP_FLAG_ACK 0x10
+#define TCP_FLAG_CWR 0x80
+
+/**
+* Internet checksum (RFC 1071) helpers.
+*
+* The sums are kept in host byte order: the one's complement sum is byte order independent,
+* so the folded result can be stored into the packet as it is.
+*/
+class Checksum {
+  public:
+    /**
+    * Add a buffer to a running sum. The buffer must start at an even offset of the checksummed data.
+    * @param data The buffer
+    * @param len The length of the buffer
+    * @param sum The running sum
+    * @return The new running sum
+    */
+    static uint64_t add(const uint8_t *data, std::size_t len, uint64_t sum) {
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+        uint64x2_t acc = vdupq_n_u64(0);
+        while (len >= 16) {
+            acc = vpadalq_u32(acc, vreinterpretq_u32_u8(vld1q_u8(data)));
+            data += 16;
+            len -= 16;
+        }
+        sum += vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#else
+        // four independent 32 bit words per iteration, the compiler can vectorise this
+        while (len >= 16) {
+            uint32_t w[4];
+            memcpy(w, data, 16);
+            sum += (uint64_t)w[0] + w[1] + (uint64_t)w[2] + w[3];
+            data += 16;
+            len -= 16;
+        }
+#endif
+        while (len >= 4) {
+            uint32_t w;
+            memcpy(&w, data, 4);
+            sum += w;
+            data += 4;
+            len -= 4;
+        }
+        if (len >= 2) {
+            uint16_t w;
+            memcpy(&w, data, 2);
+            sum += w;
+            data += 2;
+            len -= 2;
+        }
+        if (len) {
+            uint8_t tail[2] = {data[0], 0};
+            uint16_t w;
+            memcpy(&w, tail, 2);
+            sum += w;
+        }
+        return sum;
+    };
+
+    /**
+    * Fold a running sum to 16 bits.
+    * @param sum The running sum
+    * @return The folded sum, not complemented
+    */
+    static uint16_t fold(uint64_t sum) {
+        while (sum >> 16) {
+            sum = (sum & 0xFFFF) + (sum >> 16);
+        }
+        return sum;
+    };
+
+    /**
+    * Sum of the TCP/UDP pseudo header.
+    * @param ip The IPv4 or IPv6 header
+    * @param ipv4 True for IPv4
+    * @param proto The transport protocol number
+    * @param l4Len The length of the transport header and payload
+    * @return The running sum
+    */
+    static uint64_t pseudoHeader(const uint8_t *ip, bool ipv4, uint8_t proto, std::size_t l4Len) {
+        uint64_t sum = ipv4 ? add(ip + 12, 8, 0) : add(ip + 8, 32, 0);
+        sum += htons(proto);
+        sum += htons(l4Len);
+        return sum;
+    };
+
+    /**
+    * Compute and store the IPv4 header checksum.
+    * @param ip The IPv4 header
+    */
+    static void setIpv4(uint8_t *ip) {
+        ip[10] = ip[11] = 0;
+        uint16_t check = ~fold(add(ip, (ip[0] & 0x0F) * 4, 0));
+        memcpy(ip + 10, &check, 2);
+    };
+
+    /**
+    * Compute and store the TCP/UDP checksum.
+    * @param ip The IPv4 or IPv6 header
+    * @param ipv4 True for IPv4
+    * @param proto The transport protocol number
+    * @param l4 The transport header, followed by the payload
+    * @param l4Len The length of the transport header and payload
+    */
+    static void setL4(const uint8_t *ip, bool ipv4, uint8_t proto, uint8_t *l4, std::size_t l4Len) {
+        std::size_t offset = (proto == IP_PROTO_UDP) ? 6 : 16;
+        l4[offset] = l4[offset + 1] = 0;
+        uint16_t check = ~fold(add(l4, l4Len, pseudoHeader(ip, ipv4, proto, l4Len)));
+        if (check == 0 && proto == IP_PROTO_UDP) {
+            check = 0xFFFF;
+        }
+        memcpy(l4 + offset, &check, 2);
+    };
+
+    /**
+    * Verify the IPv4 header checksum.
+    * @param ip The IPv4 header
+    * @return True if the checksum is correct
+    */
+    static bool validIpv4(const uint8_t *ip) {
+        return fold(add(ip, (ip[0] & 0x0F) * 4, 0)) == 0xFFFF;
+    };
+
+    /**
+    * Verify the TCP/UDP checksum.
+    * @param ip The IPv4 or IPv6 header
+    * @param ipv4 True for IPv4
+    * @param proto The transport protocol number
+    * @param l4 The transport header, followed by the payload
+    * @param l4Len The length of the transport header and payload
+    * @return True if the checksum is correct
+    */
+    static bool validL4(const uint8_t *ip, bool ipv4, uint8_t proto, const uint8_t *l4, std::size_t l4Len) {
+        return fold(add(l4, l4Len, pseudoHeader(ip, ipv4, proto, l4Len))) == 0xFFFF;
+    };
+};
+
+/**
+* Segmentation and checksum completion of the packets read from a TUN/TAP device opened with IFF_VNET_HDR.
+*
+* With the TSO/UFO offloads enabled the kernel hands over up to 64KB super packets and
+* packets with a partial checksum (VIRTIO_NET_HDR_F_NEEDS_CSUM). This class does the work the
+* kernel would have done, producing frames which fit the radio.
+*/
+class GsoSegmenter {
+  public:
+    /**
+    * Split a packet into frames for the radio and complete the checksums.
+    * @param frame The ethernet frame following the virtio net header
+    * @param len The length of the frame
+    * @param vh The virtio net header of the frame
+    * @param maxFrame The maximal size of a resulting frame
+    * @param radioChunk The payload size of a radio fragment. TCP segments are shortened
+    *                   to fill the last fragment if that costs less than one fragment. 0 to disable
+    * @param out The resulting frames are appended
+    * @return False if the packet could not be handled
+    */
+    static bool segment(const uint8_t *frame, std::size_t len, const virtio_net_hdr &vh,
+                        std::size_t maxFrame, std::size_t radioChunk, std::vector<Message> &out) {
+        std::vector<uint8_t> buf(frame, frame + len);
+        uint8_t gsoType = vh.gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+
+        // TCP segments get their checksums computed one by one below
+        if ((vh.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) &&
+            gsoType != VIRTIO_NET_HDR_GSO_TCPV4 && gsoType != VIRTIO_NET_HDR_GSO_TCPV6) {
+            if (vh.csum_start + vh.csum_offset + 2u > len) {
+                return false;
+            }
+            // the checksum field holds the pseudo header sum
+            uint16_t check = ~Checksum::fold(Checksum::add(&buf[vh.csum_start], len - vh.csum_start, 0));
+            if (check == 0 && vh.csum_offset == 6) {
+                check = 0xFFFF; // UDP
+            }
+            memcpy(&buf[vh.csum_start + vh.csum_offset], &check, 2);
+        }
+
+        if (gsoType == VIRTIO_NET_HDR_GSO_NONE) {
+            Message msg;
+            msg.setPayload(&buf[0], len);
+            out.push_back(msg);
+            return true;
+        }
+
+        if (len < ETH_HDR_LEN + 40) {
+            return false;
+        }
+
+        int etherType = (buf[12] << 8) | buf[13];
+        bool ipv4 = etherType == ETH_TYPE_IPV4;
+        if (!ipv4 && etherType != ETH_TYPE_IPV6) {
+            return false;
+        }
+        std::size_t ipHl = ipv4 ? (buf[ETH_HDR_LEN] & 0x0F) * 4 : 40;
+        uint8_t proto = ipv4 ? buf[ETH_HDR_LEN + 9] : buf[ETH_HDR_LEN + 6];
+
+        if ((gsoType == VIRTIO_NET_HDR_GSO_TCPV4 || gsoType == VIRTIO_NET_HDR_GSO_TCPV6) && proto == IP_PROTO_TCP) {
+            return segmentTcp(buf, ipv4, ipHl, vh.gso_size, maxFrame, radioChunk, out);
+        }
+        if (gsoType == VIRTIO_NET_HDR_GSO_UDP && proto == IP_PROTO_UDP) {
+            return fragmentUdp(buf, ipv4, ipHl, maxFrame, out);
+        }
+        return false;
+    };
+
+  private:
+    static bool segmentTcp(std::vector<uint8_t> &buf, bool ipv4, std::size_t ipHl, std::size_t mss,
+                           std::size_t maxFrame, std::size_t radioChunk, std::vector<Message> &out) {
+        std::size_t l4 = ETH_HDR_LEN + ipHl;
+        if (buf.size() < l4 + 20) {
+            return false;
+        }
+        std::size_t tcpHl = (buf[l4 + 12] >> 4) * 4;
+        std::size_t hdrLen = l4 + tcpHl;
+        if (buf.size() < hdrLen || maxFrame <= hdrLen || mss == 0) {
+            return false;
+        }
+
+        if (hdrLen + mss > maxFrame) {
+            mss = maxFrame - hdrLen;
+        }
+        if (radioChunk > 0 && mss > radioChunk) {
+            std::size_t spill = (hdrLen + mss) % radioChunk;
+            if (spill > 0 && spill < radioChunk / 2) {
+                mss -= spill; // do not start a radio fragment for a few bytes
+            }
+        }
+
+        std::size_t payloadLen = buf.size() - hdrLen;
+        uint32_t seq;
+        uint16_t ipId;
+        memcpy(&seq, &buf[l4 + 4], 4);
+        memcpy(&ipId, &buf[ETH_HDR_LEN + 4], 2);
+        seq = ntohl(seq);
+        ipId = ntohs(ipId);
+        uint8_t flags = buf[l4 + 13];
+
+        std::vector<uint8_t> seg(hdrLen + mss);
+        for (std::size_t off = 0, i = 0; off < payloadLen; off += mss, i++) {
+            std::size_t n = (payloadLen - off < mss) ? payloadLen - off : mss;
+            memcpy(&seg[0], &buf[0], hdrLen);
+            memcpy(&seg[hdrLen], &buf[hdrLen + off], n);
+            uint8_t *ip = &seg[ETH_HDR_LEN];
+            uint8_t *tcp = &seg[l4];
+
+            if (ipv4) {
+                uint16_t totalLen = htons(ipHl + tcpHl + n);
+                uint16_t id = htons(ipId + i);
+                memcpy(ip + 2, &totalLen, 2);
+                memcpy(ip + 4, &id, 2);
+                Checksum::setIpv4(ip);
+            } else {
+                uint16_t payloadLen6 = htons(tcpHl + n);
+                memcpy(ip + 4, &payloadLen6, 2);
+            }
+
+            uint32_t segSeq = htonl(seq + off);
+            memcpy(tcp + 4, &segSeq, 4);
+            uint8_t segFlags = flags;
+            if (off + n < payloadLen) {
+                segFlags &= ~(TCP_FLAG_FIN | TCP_FLAG_PSH);
+            }
+            if (i > 0) {
+                segFlags &= ~TCP_FLAG_CWR;
+            }
+            tcp[13] = segFlags;
+            Checksum::setL4(ip, ipv4, IP_PROTO_TCP, tcp, tcpHl + n);
+
+            Message msg;
+            msg.setPayload(&seg[0], hdrLen + n);
+            out.push_back(msg);
+        }
+        return true;
+    };
+
+    static bool fragmentUdp(std::vector<uint8_t> &buf, bool ipv4, std::size_t ipHl,
+                            std::size_t maxFrame, std::vector<Message> &out) {
+        static std::atomic<uint32_t> fragId(1);
+        std::size_t l4 = ETH_HDR_LEN + ipHl;
+        std::size_t fragHl = ipv4 ? 0 : 8;
+        if (maxFrame < l4 + fragHl + 8) {
+            return false;
+        }
+        std::size_t dataLen = buf.size() - l4;  // UDP header and payload
+        std::size_t chunk = (maxFrame - l4 - fragHl) & ~(std::size_t)7;
+        uint32_t id = htonl(fragId++);
+
+        std::vector<uint8_t> frag(l4 + fragHl + chunk);
+        for (std::size_t off = 0; off < dataLen; off += chunk) {
+            std::size_t n = (dataLen - off < chunk) ? dataLen - off : chunk;
+            bool more = off + n < dataLen;
+            memcpy(&frag[0], &buf[0], l4);
+            memcpy(&frag[l4 + fragHl], &buf[l4 + off], n);
+            uint8_t *ip = &frag[ETH_HDR_LEN];
+
+            if (ipv4) {
+                uint16_t totalLen = htons(ipHl + n);
+                uint16_t fragField = htons((off / 8) | (more ? 0x2000 : 0));
+                memcpy(ip + 2, &totalLen, 2);
+                memcpy(ip + 6, &fragField, 2);
+                Checksum::setIpv4(ip);
+            } else {
+                uint16_t payloadLen6 = htons(fragHl + n);
+                uint16_t fragField = htons((off & ~(std::size_t)7) | (more ? 1 : 0));
+                memcpy(ip + 4, &payloadLen6, 2);
+                ip[6] = 44;  // fragment header
+                uint8_t *fh = &frag[l4];
+                fh[0] = IP_PROTO_UDP;
+                fh[1] = 0;
+                memcpy(fh + 2, &fragField, 2);
+                memcpy(fh + 4, &id, 4);
+            }
+
+            Message msg;
+            msg.setPayload(&frag[0], l4 + fragHl + n);
+            out.push_back(msg);
+        }
+        return true;
+    };
+};
+
+/**
+* Coalescing of consecutive TCP/IPv4 segments of one flow received from the radio into one
+* super packet for the TUN/TAP device (the receive side counterpart of GsoSegmenter).
+*
+* The NRF24L01 CRC only covers one 32 Byte frame on one hop, not the RF24Network reassembly or relays.
+* So the IPv4 and TCP checksums of every segment are verified before it is merged, like GRO does.
+* Verified single frames are handed over with VIRTIO_NET_HDR_F_DATA_VALID, all other frames without flags.
+* Coalesced packets carry a partial checksum, so the kernel can segment them again if they are forwarded.
+*/
+class TcpCoalescer {
+  public:
+    explicit TcpCoalescer(std::size_t maxSize = 65535) :
+        maxSize_(maxSize),
+        coalescable_(false),
+        verified_(false),
+        segments_(0),
+        mss_(0),
+        lastPayload_(0),
+        nextSeq_(0),
+        lastFlags_(0) {};
+
+    /**
+    * Start a new packet.
+    * @param msg The first frame
+    */
+    void start(Message &msg) {
+        buf_.assign(sizeof(virtio_net_hdr), 0);
+        buf_.insert(buf_.end(), msg.getPayload(), msg.getPayload() + msg.getLength());
+        segments_ = 1;
+
+        // RF24Network reassembly and relays are not covered by the radio CRC, check before telling the kernel so
+        std::size_t payload;
+        coalescable_ = parse(msg.getPayload(), msg.getLength(), payload) && verify(msg.getPayload());
+        verified_ = coalescable_;
+        if (coalescable_) {
+            const uint8_t *tcp = msg.getPayload() + ETH_HDR_LEN + 20;
+            mss_ = lastPayload_ = payload;
+            nextSeq_ = readSeq(tcp) + payload;
+            lastFlags_ = tcp[13];
+        }
+    };
+
+    /**
+    * Append the next frame if it continues the flow of the current packet.
+    * @param msg The next frame
+    * @return False if the frame can not be appended, it has to start a new packet
+    */
+    bool append(Message &msg) {
+        std::size_t payload;
+        if (!coalescable_ || (lastFlags_ & TCP_FLAG_PSH) || lastPayload_ != mss_ ||
+            !parse(msg.getPayload(), msg.getLength(), payload) || !verify(msg.getPayload())) {
+            return false;
+        }
+
+        const uint8_t *first = &buf_[sizeof(virtio_net_hdr)];
+        const uint8_t *next = msg.getPayload();
+        const uint8_t *firstTcp = first + ETH_HDR_LEN + 20;
+        const uint8_t *nextTcp = next + ETH_HDR_LEN + 20;
+        std::size_t hdrLen = ETH_HDR_LEN + 20 + (firstTcp[12] >> 4) * 4;
+
+        if (payload > mss_ || buf_.size() - sizeof(virtio_net_hdr) - ETH_HDR_LEN + payload > maxSize_ ||
+            memcmp(first + ETH_HDR_LEN + 12, next + ETH_HDR_LEN + 12, 8) != 0 ||  // addresses
+            memcmp(firstTcp, nextTcp, 4) != 0 ||  // ports
+            memcmp(firstTcp + 8, nextTcp + 8, 5) != 0 ||  // ack and header length
+            memcmp(firstTcp + 20, nextTcp + 20, hdrLen - ETH_HDR_LEN - 40) != 0 ||  // options
+            readSeq(nextTcp) != nextSeq_) {
+            return false;
+        }
+
+        buf_.insert(buf_.end(), next + hdrLen, next + hdrLen + payload);
+        memcpy(&buf_[sizeof(virtio_net_hdr) + ETH_HDR_LEN + 20 + 14], nextTcp + 14, 2);  // latest window
+        nextSeq_ += payload;
+        lastPayload_ = payload;
+        lastFlags_ = nextTcp[13];
+        segments_++;
+        return true;
+    };
+
+    /**
+    * Finish the current packet.
+    * @param len Set to the length of the packet including the virtio net header
+    * @return The packet to write to the TUN/TAP device
+    */
+    const uint8_t* finish(std::size_t &len) {
+        virtio_net_hdr vh;
+        memset(&vh, 0, sizeof(vh));
+
+        if (segments_ == 1) {
+            // unverified frames go without flags, the kernel checks them
+            vh.flags = verified_ ? VIRTIO_NET_HDR_F_DATA_VALID : 0;
+            vh.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+        } else {
+            uint8_t *ip = &buf_[sizeof(virtio_net_hdr) + ETH_HDR_LEN];
+            uint8_t *tcp = ip + 20;
+            std::size_t l4Len = buf_.size() - sizeof(virtio_net_hdr) - ETH_HDR_LEN - 20;
+            uint16_t totalLen = htons(20 + l4Len);
+            memcpy(ip + 2, &totalLen, 2);
+            Checksum::setIpv4(ip);
+            tcp[13] |= lastFlags_ & TCP_FLAG_PSH;
+            uint16_t partial = Checksum::fold(Checksum::pseudoHeader(ip, true, IP_PROTO_TCP, l4Len));
+            memcpy(tcp + 16, &partial, 2);
+
+            vh.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+            vh.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+            vh.hdr_len = ETH_HDR_LEN + 20 + (tcp[12] >> 4) * 4;
+            vh.gso_size = mss_;
+            vh.csum_start = ETH_HDR_LEN + 20;
+            vh.csum_offset = 16;
+        }
+
+        memcpy(&buf_[0], &vh, sizeof(vh));
+        len = buf_.size();
+        return &buf_[0];
+    };
+
+    /**
+    * @return True if more frames may be appended to the current packet
+    */
+    bool canGrow() {
+        return coalescable_ && !(lastFlags_ & TCP_FLAG_PSH) && lastPayload_ == mss_;
+    };
+
+    /**
+    * @return The number of frames in the current packet
+    */
+    std::size_t getSegments() {
+        return segments_;
+    };
+
+  private:
+    /**
+    * Check if a frame is a plain TCP/IPv4 data segment which may be coalesced.
+    */
+    static bool parse(const uint8_t *frame, std::size_t len, std::size_t &payload) {
+        if (len < ETH_HDR_LEN + 40 || ((frame[12] << 8) | frame[13]) != ETH_TYPE_IPV4) {
+            return false;
+        }
+        const uint8_t *ip = frame + ETH_HDR_LEN;
+        const uint8_t *tcp = ip + 20;
+        std::size_t tcpHl = (tcp[12] >> 4) * 4;
+        std::size_t totalLen = (ip[2] << 8) | ip[3];
+        if (ip[0] != 0x45 || ip[9] != IP_PROTO_TCP || (ip[6] & 0x3F) != 0 || ip[7] != 0 ||
+            tcpHl < 20 || totalLen != len - ETH_HDR_LEN || totalLen <= 20 + tcpHl ||
+            (tcp[13] & ~(TCP_FLAG_ACK | TCP_FLAG_PSH)) != 0 || !(tcp[13] & TCP_FLAG_ACK)) {
+            return false;
+        }
+        payload = totalLen - 20 - tcpHl;
+        return true;
+    };
+
+    /**
+    * Verify the IPv4 and TCP checksums of a frame accepted by parse(), as GRO does before merging.
+    */
+    static bool verify(const uint8_t *frame) {
+        const uint8_t *ip = frame + ETH_HDR_LEN;
+        std::size_t totalLen = (ip[2] << 8) | ip[3];
+        return Checksum::validIpv4(ip) && Checksum::validL4(ip, true, IP_PROTO_TCP, ip + 20, totalLen - 20);
+    };
+
+    static uint32_t readSeq(const uint8_t *tcp) {
+        uint32_t seq;
+        memcpy(&seq, tcp + 4, 4);
+        return ntohl(seq);
+    };
+
+    std::vector<uint8_t> buf_;  /**< The virtio net header followed by the packet */
+    std::size_t maxSize_;  /**< Maximal IP packet size */
+    bool coalescable_;  /**< The first frame is a TCP/IPv4 data segment with valid checksums */
+    bool verified_;  /**< The checksums of all frames in the packet were verified */
+    std::size_t segments_;  /**< Number of frames in the packet */
+    std::size_t mss_;  /**< Payload size of the first frame */
+    std::size_t lastPayload_;  /**< Payload size of the last frame */
+    uint32_t nextSeq_;  /**< Expected sequence number of the next frame */
+    uint8_t lastFlags_;  /**< TCP flags of the last frame */
+};
+
+#endif // __GSOOFFLOAD_H__
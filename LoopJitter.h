@@ -0,0 +1,113 @@
+/*
+ * The MIT License (MIT)
+ * Copyright (c) 2014 Rei <devel@reixd.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __LOOPJITTER_H__
+#define __LOOPJITTER_H__
+
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <string>
+
+#define JITTER_BUCKETS 24 /**< Power of two buckets, the last one holds everything above 2^22 us */
+
+/**
+* Histogram of the iteration times of a loop, e.g. the radio loop.
+*
+* The iteration times are sorted into power of two buckets in microseconds. Additionally the worst case
+* and the number of stalls (iterations longer than a threshold) are kept.
+* Only one thread may record, any thread may print.
+*/
+class LoopJitter {
+  public:
+    /**
+    * @param stallThresholdUs Iterations longer than this are counted as stalls
+    */
+    explicit LoopJitter(uint32_t stallThresholdUs = 500) :
+        stallThresholdUs_(stallThresholdUs),
+        iterations_(0),
+        stalls_(0),
+        maxUs_(0) {
+        for (int i = 0; i < JITTER_BUCKETS; i++) {
+            buckets_[i] = 0;
+        }
+    };
+
+    /**
+    * Set the stall threshold.
+    * @param stallThresholdUs Iterations longer than this are counted as stalls
+    */
+    void setStallThreshold(uint32_t stallThresholdUs) {
+        stallThresholdUs_ = stallThresholdUs;
+    };
+
+    /**
+    * Record one iteration.
+    * @param us The iteration time in microseconds
+    */
+    void record(uint32_t us) {
+        int bucket = 0;
+        while (bucket < JITTER_BUCKETS - 1 && (us >> bucket) > 0) {
+            bucket++;
+        }
+        buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        iterations_.fetch_add(1, std::memory_order_relaxed);
+        if (us > stallThresholdUs_) {
+            stalls_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (us > maxUs_.load(std::memory_order_relaxed)) {
+            maxUs_.store(us, std::memory_order_relaxed);
+        }
+    };
+
+    /**
+    * Print the histogram to stdout. Empty buckets are skipped.
+    * @param name The name of the loop
+    */
+    void print(const std::string &name) {
+        std::cout << name << " jitter: " << iterations_.load() << " iterations, max " << maxUs_.load()
+                  << " us, " << stalls_.load() << " stalls > " << stallThresholdUs_ << " us" << std::endl;
+        for (int i = 0; i < JITTER_BUCKETS; i++) {
+            unsigned long count = buckets_[i].load();
+            if (count == 0) {
+                continue;
+            }
+            if (i == JITTER_BUCKETS - 1) {
+                // the last bucket also holds everything that did not fit the others
+                std::cout << "  >= " << std::setw(7) << (1UL << (i - 1)) << " us: " << count << std::endl;
+            } else {
+                std::cout << "  < " << std::setw(8) << (1UL << i) << " us: " << count << std::endl;
+            }
+        }
+    };
+
+  private:
+    uint32_t stallThresholdUs_;
+    std::atomic<unsigned long> buckets_[JITTER_BUCKETS];  /**< Bucket i counts iterations shorter than 2^i us */
+    std::atomic<unsigned long> iterations_;
+    std::atomic<unsigned long> stalls_;
+    std::atomic<uint32_t> maxUs_;  /**< Worst case iteration time */
+};
+
+#endif // __LOOPJITTER_H__
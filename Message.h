@@ -21,6 +21,9 @@
  *
  */
 
+#ifndef __MESSAGE_H__
+#define __MESSAGE_H__
+
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -94,3 +97,5 @@ class Message {
     uint8_t seqNo_;  /**< Sequence number */
 
 };
+
+#endif // __MESSAGE_H__
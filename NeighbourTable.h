@@ -0,0 +1,147 @@
+/*
+ * The MIT License (MIT)
+ * Copyright (c) 2014 Rei <devel@reixd.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __NEIGHBOURTABLE_H__
+#define __NEIGHBOURTABLE_H__
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+/**
+* A learned neighbour, as exported for the state snapshot.
+*/
+struct NeighbourEntry {
+    uint32_t ip;  /**< IPv4 address in network byte order */
+    uint16_t node;  /**< RF24Network address */
+    uint64_t ageMs;  /**< Time since the node was last heard with this IP */
+};
+
+/**
+* This class maps the IPv4 addresses seen on the air to the RF24Network node sending them.
+*
+* The entries are learned from the source of the received frames (IPv4 and ARP)
+* and expire if the node was not heard for a while, like an ARP cache. The class is thread safe.
+*/
+class NeighbourTable {
+  public:
+    NeighbourTable() :
+        timeoutMs_(5 * 60 * 1000) {};
+
+    /**
+    * Learn or refresh the node of an IPv4 address.
+    * @param ip The IPv4 address in network byte order
+    * @param node The RF24Network address of the node
+    * @param nowMs A monotonic timestamp in milliseconds
+    */
+    void learn(uint32_t ip, uint16_t node, uint64_t nowMs) {
+        boost::lock_guard<boost::mutex> l(m_);
+        Entry &e = entries_[ip];
+        e.node = node;
+        e.seenMs = nowMs;
+    };
+
+    /**
+    * Restore an entry, e.g. from a state snapshot. Entries older than the timeout are ignored.
+    * @param entry The entry
+    * @param nowMs A monotonic timestamp in milliseconds
+    */
+    void restore(const NeighbourEntry &entry, uint64_t nowMs) {
+        boost::lock_guard<boost::mutex> l(m_);
+        if (entry.ageMs >= timeoutMs_) {
+            return;
+        }
+        Entry &e = entries_[entry.ip];
+        e.node = entry.node;
+        e.seenMs = (int64_t)nowMs - (int64_t)entry.ageMs; // before the monotonic epoch after a reboot
+    };
+
+    /**
+    * Look up the node of an IPv4 address.
+    * @param ip The IPv4 address in network byte order
+    * @param node Set to the RF24Network address if found
+    * @param nowMs A monotonic timestamp in milliseconds
+    * @return True if a valid entry was found
+    */
+    bool lookup(uint32_t ip, uint16_t &node, uint64_t nowMs) {
+        boost::lock_guard<boost::mutex> l(m_);
+        std::map<uint32_t, Entry>::iterator it = entries_.find(ip);
+        if (it == entries_.end()) {
+            return false;
+        }
+        if ((int64_t)nowMs - it->second.seenMs > (int64_t)timeoutMs_) {
+            entries_.erase(it);
+            return false;
+        }
+        node = it->second.node;
+        return true;
+    };
+
+    /**
+    * Set after how long an entry which was not refreshed expires.
+    * @param timeoutMs The timeout in milliseconds
+    */
+    void setTimeout(uint64_t timeoutMs) {
+        boost::lock_guard<boost::mutex> l(m_);
+        timeoutMs_ = timeoutMs;
+    };
+
+    /**
+    * Get all the entries which did not expire yet.
+    * @param entries The entries are appended
+    * @param nowMs A monotonic timestamp in milliseconds
+    */
+    void getEntries(std::vector<NeighbourEntry> &entries, uint64_t nowMs) {
+        boost::lock_guard<boost::mutex> l(m_);
+        for (std::map<uint32_t, Entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+            if ((int64_t)nowMs - it->second.seenMs <= (int64_t)timeoutMs_) {
+                NeighbourEntry e = {it->first, it->second.node, (uint64_t)((int64_t)nowMs - it->second.seenMs)};
+                entries.push_back(e);
+            }
+        }
+    };
+
+    /**
+    * Get the number of entries.
+    * @return The number of entries, including the expired ones not removed yet
+    */
+    std::size_t size() {
+        boost::lock_guard<boost::mutex> l(m_);
+        return entries_.size();
+    };
+
+  private:
+    struct Entry {
+        Entry() : node(0), seenMs(0) {};
+        uint16_t node;  /**< RF24Network address */
+        int64_t seenMs;  /**< Last time the node was heard with this IP, negative for restored entries older than the uptime */
+    };
+
+    boost::mutex m_;
+    std::map<uint32_t, Entry> entries_;  /**< IPv4 address to node */
+    uint64_t timeoutMs_;  /**< Entry expiry time */
+};
+
+#endif // __NEIGHBOURTABLE_H__
@@ -0,0 +1,429 @@
+/*
+ * The MIT License (MIT)
+ * Copyright (c) 2014 Rei <devel@reixd.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __PACKETCAPTURE_H__
+#define __PACKETCAPTURE_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <new>
+#include <time.h>
+#include <sys/mman.h>
+
+/**
+* The points of the data path where packets are captured. In the pcapng file every point is an interface.
+*/
+enum CapturePoint {
+    CAPTURE_TUN_READ = 0,  /**< Read from the TUN/TAP device */
+    CAPTURE_RADIO_TX,  /**< Handed to RF24Network for sending */
+    CAPTURE_RADIO_RX,  /**< Received from RF24Network */
+    CAPTURE_TUN_WRITE,  /**< Written to the TUN/TAP device */
+    CAPTURE_POINTS
+};
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+
+/**
+* Packet capture into a preallocated memory-mapped ring, flushed as pcapng by a writer thread.
+*
+* capture() never blocks and never allocates: it claims a slot with a compare-and-swap, copies the packet
+* and its timestamp and publishes the slot. If the writer falls behind the packet is dropped and counted,
+* the data path is never stalled. Any number of threads may capture, only one thread may flush.
+*
+* The timestamps are taken from CLOCK_MONOTONIC, offset to the wall clock once at open(), so a step of
+* the wall clock (NTP, fake-hwclock) during the capture does not show up as a gap in the trace.
+*/
+class PacketCapture {
+  public:
+    PacketCapture() :
+        ring_(NULL),
+        ringSize_(0),
+        slotSize_(0),
+        snaplen_(0),
+        mask_(0),
+        enqueuePos_(0),
+        dequeuePos_(0),
+        realtimeOffsetNs_(0),
+        file_(NULL),
+        captured_(0),
+        dropped_(0) {};
+
+    ~PacketCapture() {
+        close();
+    };
+
+    /**
+    * Allocate the ring and create the pcapng file.
+    * @param path The path of the pcapng file
+    * @param slots Number of packets the ring can hold, rounded up to a power of two
+    * @param snaplen Maximal number of bytes captured per packet
+    * @return False if the ring or the file could not be created
+    */
+    bool open(const std::string &path, std::size_t slots, std::size_t snaplen) {
+        std::size_t size = 1;
+        while (size < slots) {
+            size <<= 1;
+        }
+        snaplen_ = snaplen;
+        slotSize_ = (sizeof(Slot) + snaplen + 7) & ~(std::size_t)7;
+        ringSize_ = size * slotSize_;
+        mask_ = size - 1;
+
+        void *ring = mmap(NULL, ringSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (ring == MAP_FAILED) {
+            return false;
+        }
+        ring_ = (uint8_t *)ring;
+        for (std::size_t i = 0; i < size; i++) {
+            new (slot(i)) Slot();
+            slot(i)->seq.store(i, std::memory_order_relaxed);
+        }
+
+        file_ = fopen(path.c_str(), "wb");
+        if (file_ == NULL) {
+            close();
+            return false;
+        }
+        realtimeOffsetNs_ = clockNs(CLOCK_REALTIME) - clockNs(CLOCK_MONOTONIC);
+        writeHeader();
+        return true;
+    };
+
+    /**
+    * Flush the remaining packets, close the file and free the ring.
+    */
+    void close() {
+        if (file_ != NULL) {
+            flush();
+            fclose(file_);
+            file_ = NULL;
+        }
+        if (ring_ != NULL) {
+            munmap(ring_, ringSize_);
+            ring_ = NULL;
+        }
+    };
+
+    /**
+    * @return True if packets are captured
+    */
+    bool isOpen() {
+        return ring_ != NULL && file_ != NULL;
+    };
+
+    /**
+    * Capture a packet. Never blocks, the packet is dropped if the ring is full.
+    * @param point Where the packet was seen
+    * @param data The packet
+    * @param len The length of the packet
+    */
+    void capture(CapturePoint point, const uint8_t *data, std::size_t len) {
+        if (ring_ == NULL) {
+            return;
+        }
+
+        // stamp before claiming the slot, so the order in the ring follows the timestamps
+        uint64_t tsNs = clockNs(CLOCK_MONOTONIC) + realtimeOffsetNs_;
+
+        Slot *s;
+        std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            s = slot(pos & mask_);
+            std::size_t seq = s->seq.load(std::memory_order_acquire);
+            if (seq == pos) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (seq < pos) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return; // full, the writer did not free this slot yet
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        s->tsNs = tsNs;
+        s->point = point;
+        s->len = len;
+        s->caplen = (len < snaplen_) ? len : snaplen_;
+        memcpy((uint8_t *)s + sizeof(Slot), data, s->caplen);
+        s->seq.store(pos + 1, std::memory_order_release);
+        captured_.fetch_add(1, std::memory_order_relaxed);
+    };
+
+    /**
+    * Write the captured packets to the pcapng file. Only to be called by the writer thread.
+    * @return The number of packets written
+    */
+    std::size_t flush() {
+        std::size_t written = 0;
+        if (ring_ == NULL || file_ == NULL) {
+            return 0;
+        }
+
+        for (;;) {
+            Slot *s = slot(dequeuePos_ & mask_);
+            if (s->seq.load(std::memory_order_acquire) != dequeuePos_ + 1) {
+                break; // empty or not published yet
+            }
+            writePacket(s);
+            s->seq.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+            dequeuePos_++;
+            written++;
+        }
+
+        fflush(file_);
+        return written;
+    };
+
+    /**
+    * @return The number of packets captured
+    */
+    unsigned long getCaptured() {
+        return captured_.load();
+    };
+
+    /**
+    * @return The number of packets dropped because the ring was full
+    */
+    unsigned long getDropped() {
+        return dropped_.load();
+    };
+
+  private:
+    struct Slot {
+        std::atomic<std::size_t> seq;  /**< Slot position when free, position + 1 when published */
+        uint64_t tsNs;
+        uint32_t point;
+        uint32_t len;
+        uint32_t caplen;
+    };
+
+    static uint64_t clockNs(clockid_t clock) {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    };
+
+    Slot* slot(std::size_t index) {
+        return (Slot *)(ring_ + index * slotSize_);
+    };
+
+    void writePadding(std::size_t len) {
+        static const uint8_t padding[4] = {0, 0, 0, 0};
+        fwrite(padding, 1, len, file_);
+    };
+
+    void write32(uint32_t value) {
+        fwrite(&value, 4, 1, file_);
+    };
+
+    void write16(uint16_t value) {
+        fwrite(&value, 2, 1, file_);
+    };
+
+    void writeHeader() {
+        static const char *names[CAPTURE_POINTS] = {"tun-read", "radio-tx", "radio-rx", "tun-write"};
+
+        // section header block
+        write32(PCAPNG_SHB);
+        write32(28);
+        write32(PCAPNG_BYTE_ORDER_MAGIC);
+        write16(1);
+        write16(0);
+        write32(0xFFFFFFFF);  // section length unknown
+        write32(0xFFFFFFFF);
+        write32(28);
+
+        // one interface description block per capture point
+        for (int i = 0; i < CAPTURE_POINTS; i++) {
+            uint32_t nameLen = strlen(names[i]);
+            uint32_t namePadded = (nameLen + 3) & ~3;
+            uint32_t blockLen = 20 + 4 + namePadded + 4 + 4 + 4;
+            write32(PCAPNG_IDB);
+            write32(blockLen);
+            write16(PCAPNG_LINKTYPE_ETHERNET);
+            write16(0);
+            write32(snaplen_);
+            write16(2);  // if_name
+            write16(nameLen);
+            fwrite(names[i], 1, nameLen, file_);
+            writePadding(namePadded - nameLen);
+            write16(9);  // if_tsresol, nanoseconds
+            write16(1);
+            write32(9);
+            write32(0);  // opt_endofopt
+            write32(blockLen);
+        }
+    };
+
+    void writePacket(Slot *s) {
+        uint32_t padded = (s->caplen + 3) & ~3;
+        uint32_t blockLen = 32 + padded;
+
+        write32(PCAPNG_EPB);
+        write32(blockLen);
+        write32(s->point);
+        write32(s->tsNs >> 32);
+        write32(s->tsNs & 0xFFFFFFFF);
+        write32(s->caplen);
+        write32(s->len);
+        fwrite((uint8_t *)s + sizeof(Slot), 1, s->caplen, file_);
+        writePadding(padded - s->caplen);
+        write32(blockLen);
+    };
+
+    uint8_t *ring_;  /**< Preallocated memory-mapped slots */
+    std::size_t ringSize_;
+    std::size_t slotSize_;  /**< Slot header plus snaplen, 8 byte aligned */
+    std::size_t snaplen_;
+    std::size_t mask_;
+    std::atomic<std::size_t> enqueuePos_;  /**< Next slot claimed by capture() */
+    std::size_t dequeuePos_;  /**< Next slot written by flush() */
+    uint64_t realtimeOffsetNs_;  /**< Wall clock minus monotonic clock at open() */
+    FILE *file_;
+    std::atomic<unsigned long> captured_;
+    std::atomic<unsigned long> dropped_;  /**< Packets lost because the ring was full */
+};
+
+/**
+* A packet read back from a pcapng file.
+*/
+struct CapturedPacket {
+    uint32_t interfaceId;  /**< The CapturePoint for files written by PacketCapture */
+    uint64_t tsNs;  /**< Timestamp in nanoseconds */
+    uint32_t len;  /**< Original length of the packet */
+    std::vector<uint8_t> data;  /**< The captured bytes, may be shorter than len */
+};
+
+/**
+* Minimal pcapng reader for the replay driver.
+*
+* Reads the enhanced packet blocks of files in host byte order and converts the timestamps
+* with the if_tsresol of their interface. Other blocks are skipped.
+*/
+class PcapngReader {
+  public:
+    PcapngReader() :
+        file_(NULL) {};
+
+    ~PcapngReader() {
+        if (file_ != NULL) {
+            fclose(file_);
+        }
+    };
+
+    /**
+    * Open a pcapng file.
+    * @param path The path of the file
+    * @return False if the file is not a pcapng file in host byte order
+    */
+    bool open(const std::string &path) {
+        file_ = fopen(path.c_str(), "rb");
+        if (file_ == NULL) {
+            return false;
+        }
+        uint32_t header[3];
+        if (fread(header, 4, 3, file_) != 3 || header[0] != PCAPNG_SHB || header[2] != PCAPNG_BYTE_ORDER_MAGIC) {
+            return false;
+        }
+        fseek(file_, 0, SEEK_SET);
+        return true;
+    };
+
+    /**
+    * Read the next packet.
+    * @param packet Set to the next packet
+    * @return False at the end of the file
+    */
+    bool next(CapturedPacket &packet) {
+        uint32_t header[2];
+        std::vector<uint8_t> body;
+
+        while (file_ != NULL && fread(header, 4, 2, file_) == 2) {
+            if (header[1] < 12 || (header[1] & 3) != 0) {
+                return false;
+            }
+            body.resize(header[1] - 8);
+            if (fread(&body[0], 1, body.size(), file_) != body.size()) {
+                return false;
+            }
+
+            if (header[0] == PCAPNG_SHB) {
+                tsUnitsPerSecond_.clear();
+            } else if (header[0] == PCAPNG_IDB) {
+                tsUnitsPerSecond_.push_back(parseTsResolution(body));
+            } else if (header[0] == PCAPNG_EPB && body.size() >= 24) {
+                uint32_t fields[5];
+                memcpy(fields, &body[0], sizeof(fields));
+                if (fields[3] > body.size() - 24) {
+                    return false;
+                }
+                uint64_t ts = ((uint64_t)fields[1] << 32) | fields[2];
+                uint64_t perSecond = (fields[0] < tsUnitsPerSecond_.size()) ? tsUnitsPerSecond_[fields[0]] : 1000000;
+                packet.interfaceId = fields[0];
+                packet.tsNs = (ts / perSecond) * 1000000000ULL + (ts % perSecond) * 1000000000ULL / perSecond;
+                packet.len = fields[4];
+                packet.data.assign(&body[20], &body[20] + fields[3]);
+                return true;
+            }
+        }
+        return false;
+    };
+
+  private:
+    static uint64_t parseTsResolution(const std::vector<uint8_t> &body) {
+        uint64_t perSecond = 1000000; // default microseconds
+        std::size_t pos = 8;
+        while (pos + 4 <= body.size() - 4) {
+            uint16_t code, len;
+            memcpy(&code, &body[pos], 2);
+            memcpy(&len, &body[pos + 2], 2);
+            if (code == 0) {
+                break;
+            }
+            if (code == 9 && len == 1 && pos + 5 <= body.size()) {
+                uint8_t res = body[pos + 4];
+                perSecond = 1;
+                for (int i = 0; i < (res & 0x7F) && perSecond < 1000000000000ULL; i++) {
+                    perSecond *= (res & 0x80) ? 2 : 10;
+                }
+            }
+            pos += 4 + ((len + 3) & ~3);
+        }
+        return perSecond;
+    };
+
+    FILE *file_;
+    std::vector<uint64_t> tsUnitsPerSecond_;  /**< Timestamp resolution of every interface in the section */
+};
+
+#endif // __PACKETCAPTURE_H__
@@ -0,0 +1,94 @@
+/*
+ * The MIT License (MIT)
+ * Copyright (c) 2014 Rei <devel@reixd.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __SPSCRING_H__
+#define __SPSCRING_H__
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+/**
+* Bounded lock-free queue for exactly one producer thread and one consumer thread.
+*
+* Neither side ever blocks: push() fails if the ring is full and pop() fails if it is empty.
+*/
+template <typename T>
+class SpscRing {
+  public:
+    /**
+    * @param capacity Number of slots, rounded up to a power of two
+    */
+    explicit SpscRing(std::size_t capacity) :
+        head_(0),
+        tail_(0) {
+        std::size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots_.resize(size);
+        mask_ = size - 1;
+    };
+
+    /**
+    * Enqueue an element. Only to be called by the producer thread.
+    * @param data The element to enqueue
+    * @return False if the ring is full
+    */
+    bool push(const T& data) {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) > mask_) {
+            return false;
+        }
+        slots_[head & mask_] = data;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    };
+
+    /**
+    * Dequeue an element. Only to be called by the consumer thread.
+    * @param data Set to the dequeued element
+    * @return False if the ring is empty
+    */
+    bool pop(T& data) {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        data = slots_[tail & mask_];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    };
+
+    bool empty() {
+        return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+    };
+
+  private:
+    std::vector<T> slots_;
+    std::size_t mask_;
+    std::atomic<std::size_t> head_;  /**< Next slot to write, only modified by the producer */
+    std::atomic<std::size_t> tail_;  /**< Next slot to read, only modified by the consumer */
+};
+
+#endif // __SPSCRING_H__
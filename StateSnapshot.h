@@ -0,0 +1,269 @@
+/*
+ * The MIT License (MIT)
+ * Copyright (c) 2014 Rei <devel@reixd.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ */
+
+#ifndef __STATESNAPSHOT_H__
+#define __STATESNAPSHOT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "NeighbourTable.h"
+
+#define SNAPSHOT_MAGIC 0x34324652 /**< "RF24" */
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BOOT_ID_LEN 36 /**< Length of /proc/sys/kernel/random/boot_id without the newline */
+#define SNAPSHOT_MAX_NEIGHBOURS 256
+
+/**
+* The learned state which survives a restart. The configuration (address, channel) is not part of it.
+*/
+struct SnapshotState {
+    uint16_t thisNode;  /**< The state is only valid for the node which saved it */
+    std::vector<NeighbourEntry> neighbours;  /**< IPv4 to node mapping, the ages include the downtime after load() */
+};
+
+/**
+* Compact memory-mapped file holding the last snapshot of the learned state.
+*
+* The file has two fixed size slots which are written alternately, each protected by a checksum.
+* A crash while saving only destroys the slot being written, load() picks the newest valid slot.
+*
+* The downtime added to the ages is measured with CLOCK_BOOTTIME if the system was not rebooted in between.
+* After a reboot it is at least the uptime, or the wall clock difference if that is larger: without an RTC
+* the wall clock may be stepped back, so it is only trusted to make the entries older.
+*/
+class StateSnapshot {
+  public:
+    StateSnapshot() :
+        fd_(-1),
+        map_(NULL),
+        generation_(0) {};
+
+    ~StateSnapshot() {
+        close();
+    };
+
+    /**
+    * Open (or create) and map the snapshot file.
+    * @param path The path of the snapshot file
+    * @return False if the file could not be mapped
+    */
+    bool open(const std::string &path) {
+        close();
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+        if (fd_ < 0) {
+            return false;
+        }
+        if (ftruncate(fd_, 2 * slotSize()) != 0) {
+            close();
+            return false;
+        }
+        void *map = mmap(NULL, 2 * slotSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            close();
+            return false;
+        }
+        map_ = (uint8_t *)map;
+        return true;
+    };
+
+    /**
+    * Unmap and close the snapshot file.
+    */
+    void close() {
+        if (map_ != NULL) {
+            msync(map_, 2 * slotSize(), MS_SYNC);
+            munmap(map_, 2 * slotSize());
+            map_ = NULL;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    };
+
+    /**
+    * Load the newest valid snapshot.
+    * @param state Set to the saved state
+    * @return False if there is no valid snapshot
+    */
+    bool load(SnapshotState &state) {
+        int newest = -1;
+        for (int i = 0; i < 2; i++) {
+            if (valid(i) && (newest < 0 || header(i)->generation > header(newest)->generation)) {
+                newest = i;
+            }
+        }
+        if (newest < 0) {
+            return false;
+        }
+
+        SlotHeader *h = header(newest);
+        generation_ = h->generation;
+        char bootId[SNAPSHOT_BOOT_ID_LEN];
+        uint64_t nowBootMs = bootTimeMs();
+        uint64_t downtimeMs;
+        if (readBootId(bootId) && memcmp(bootId, h->bootId, SNAPSHOT_BOOT_ID_LEN) == 0 && nowBootMs >= h->savedBootMs) {
+            downtimeMs = nowBootMs - h->savedBootMs;
+        } else {
+            downtimeMs = nowBootMs; // rebooted since the save
+            uint64_t now = time(NULL);
+            if (now > h->savedAt && (now - h->savedAt) * 1000 > downtimeMs) {
+                downtimeMs = (now - h->savedAt) * 1000;
+            }
+        }
+
+        state.thisNode = h->thisNode;
+        state.neighbours.clear();
+        SlotNeighbour *n = neighbours(newest);
+        for (uint32_t i = 0; i < h->neighbourCount; i++) {
+            NeighbourEntry e = {n[i].ip, n[i].node, n[i].ageMs + downtimeMs};
+            state.neighbours.push_back(e);
+        }
+        return true;
+    };
+
+    /**
+    * Save a snapshot into the older slot. The kernel writes it back to the file asynchronously.
+    * @param state The state to save
+    * @return False if the file is not mapped
+    */
+    bool save(const SnapshotState &state) {
+        if (map_ == NULL) {
+            return false;
+        }
+
+        int slot = (generation_ + 1) % 2;
+        SlotHeader *h = header(slot);
+        SlotNeighbour *n = neighbours(slot);
+
+        h->magic = 0; // invalid until complete
+        uint32_t count = 0;
+        for (std::size_t i = 0; i < state.neighbours.size() && count < SNAPSHOT_MAX_NEIGHBOURS; i++, count++) {
+            n[count].ip = state.neighbours[i].ip;
+            n[count].node = state.neighbours[i].node;
+            n[count].reserved = 0;
+            n[count].ageMs = state.neighbours[i].ageMs;
+        }
+
+        h->version = SNAPSHOT_VERSION;
+        h->thisNode = state.thisNode;
+        h->generation = ++generation_;
+        h->savedAt = time(NULL);
+        h->savedBootMs = bootTimeMs();
+        if (!readBootId(h->bootId)) {
+            memset(h->bootId, 0, sizeof(h->bootId));
+        }
+        h->neighbourCount = count;
+        h->checksum = 0;
+        h->magic = SNAPSHOT_MAGIC;
+        h->checksum = checksum(slot);
+
+        msync(map_ + slot * slotSize(), slotSize(), MS_ASYNC);
+        return true;
+    };
+
+  private:
+    struct SlotHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t thisNode;
+        uint64_t generation;  /**< Incremented by every save */
+        uint64_t savedAt;  /**< Wall clock time of the save in seconds */
+        uint64_t savedBootMs;  /**< CLOCK_BOOTTIME of the save in milliseconds */
+        char bootId[SNAPSHOT_BOOT_ID_LEN];  /**< Boot of the save */
+        uint32_t neighbourCount;
+        uint32_t checksum;  /**< FNV-1a of the slot with this field set to 0 */
+    };
+
+    struct SlotNeighbour {
+        uint32_t ip;
+        uint16_t node;
+        uint16_t reserved;
+        uint64_t ageMs;
+    };
+
+    static uint64_t bootTimeMs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    };
+
+    static bool readBootId(char *bootId) {
+        int fd = ::open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = read(fd, bootId, SNAPSHOT_BOOT_ID_LEN) == SNAPSHOT_BOOT_ID_LEN;
+        ::close(fd);
+        return ok;
+    };
+
+    static std::size_t slotSize() {
+        return sizeof(SlotHeader) + SNAPSHOT_MAX_NEIGHBOURS * sizeof(SlotNeighbour);
+    };
+
+    SlotHeader* header(int slot) {
+        return (SlotHeader *)(map_ + slot * slotSize());
+    };
+
+    SlotNeighbour* neighbours(int slot) {
+        return (SlotNeighbour *)(map_ + slot * slotSize() + sizeof(SlotHeader));
+    };
+
+    bool valid(int slot) {
+        SlotHeader *h = header(slot);
+        if (map_ == NULL || h->magic != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION ||
+            h->neighbourCount > SNAPSHOT_MAX_NEIGHBOURS) {
+            return false;
+        }
+        uint32_t saved = h->checksum;
+        h->checksum = 0;
+        bool ok = checksum(slot) == saved;
+        h->checksum = saved;
+        return ok;
+    };
+
+    uint32_t checksum(int slot) {
+        const uint8_t *data = map_ + slot * slotSize();
+        std::size_t len = sizeof(SlotHeader) + header(slot)->neighbourCount * sizeof(SlotNeighbour);
+        uint32_t hash = 2166136261u;
+        for (std::size_t i = 0; i < len; i++) {
+            hash ^= data[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    };
+
+    int fd_;
+    uint8_t *map_;  /**< Both slots */
+    uint64_t generation_;  /**< Generation of the newest slot */
+};
+
+#endif // __STATESNAPSHOT_H__
@@ -41,12 +41,90 @@ bool configureAndSetUpRadio() {
     return true;
 }
 
+/**
+* Configuration of the broadcast/multicast filter rules.
+*
+* By default the chatty discovery protocols (mDNS, LLMNR, SSDP, NetBIOS, IPv6 router discovery and MLD)
+* are dropped, identical broadcasts are deduplicated and the rest is rate limited.
+* The rules from the bc-drop options are added, "bc-drop = none" removes the default rules.
+*/
+void configureBroadcastFilter() {
+
+    if (bcDefaultRules) {
+        broadcastFilter.addDropRule(BC_ANY, IP_PROTO_UDP, 5353);  // mDNS
+        broadcastFilter.addDropRule(BC_ANY, IP_PROTO_UDP, 5355);  // LLMNR
+        broadcastFilter.addDropRule(BC_ANY, IP_PROTO_UDP, 1900);  // SSDP
+        broadcastFilter.addDropRule(ETH_TYPE_IPV4, IP_PROTO_UDP, 137);  // NetBIOS name service
+        broadcastFilter.addDropRule(ETH_TYPE_IPV4, IP_PROTO_UDP, 138);  // NetBIOS datagram service
+        broadcastFilter.addDropRule(ETH_TYPE_IPV4, IP_PROTO_UDP, 17500);  // Dropbox LAN sync
+        broadcastFilter.addDropRule(ETH_TYPE_IPV6, IP_PROTO_ICMPV6, 133);  // Router solicitation
+        broadcastFilter.addDropRule(ETH_TYPE_IPV6, IP_PROTO_ICMPV6, 134);  // Router advertisement
+        broadcastFilter.addDropRule(ETH_TYPE_IPV6, IP_PROTO_ICMPV6, 143);  // MLDv2 report
+    }
+
+    for (std::size_t i = 0; i < bcDropRules.size(); i++) {
+        broadcastFilter.addDropRule(bcDropRules[i]);
+    }
+
+    broadcastFilter.setDropMulticast(!bcMulticast);
+    broadcastFilter.setDedupWindow(bcDedupWindowMs);
+    broadcastFilter.setRateLimit(bcRateLimit, bcBurst);
+}
+
+/**
+* Parse a broadcast drop rule: "[ipv4/|ipv6/]udp|tcp|icmpv6[:port]", e.g. "udp:5353" or "ipv6/icmpv6:133".
+* For ICMPv6 the port is the message type.
+*
+* @param value The rule
+* @param rule Set to the parsed rule
+* @return False if the rule is invalid
+*/
+bool parseBroadcastRule(const std::string &value, BroadcastRule &rule) {
+    std::string proto = value;
+    rule.etherType = BC_ANY;
+    rule.port = BC_ANY;
+
+    if (proto.compare(0, 5, "ipv4/") == 0) {
+        rule.etherType = ETH_TYPE_IPV4;
+        proto.erase(0, 5);
+    } else if (proto.compare(0, 5, "ipv6/") == 0) {
+        rule.etherType = ETH_TYPE_IPV6;
+        proto.erase(0, 5);
+    }
+
+    std::size_t colon = proto.find(':');
+    if (colon != std::string::npos) {
+        char *end;
+        std::string port = proto.substr(colon + 1);
+        unsigned long number = strtoul(port.c_str(), &end, 10);
+        if (port.empty() || *end != '\0' || number > 65535) {
+            return false;
+        }
+        rule.port = number;
+        proto.erase(colon);
+    }
+
+    if (proto == "udp") {
+        rule.ipProto = IP_PROTO_UDP;
+    } else if (proto == "tcp") {
+        rule.ipProto = IP_PROTO_TCP;
+    } else if (proto == "icmpv6" && rule.etherType != ETH_TYPE_IPV4) {
+        rule.ipProto = IP_PROTO_ICMPV6;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
 /**
 * Configure, set up and allocate the TUN/TAP device.
 *
 * If the TUN/TAP device was allocated successfully the file descriptor is returned.
 * Otherwise the application closes with an error.
-* @note Currently only a TUN device with multi queue is used.
+* With tunQueueCount > 1 the device is opened with IFF_MULTI_QUEUE and one file descriptor per queue is
+* allocated in tunQueueFds. The kernel spreads the packets over the queues by flow hash.
+* @note A persistent device created without IFF_MULTI_QUEUE must be deleted before changing the number of queues.
 *
 * @return The TUN/TAP device file descriptor
 */
@@ -56,15 +134,31 @@ int configureAndSetUpTunDevice() {
     strcpy(tunName, tunTapDevice.c_str());
 
     //int flags = IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE;
-	int flags = IFF_TAP | IFF_NO_PI;// | IFF_MULTI_QUEUE;
-    tunFd = allocateTunDevice(tunName, flags);
-    if (tunFd >= 0) {
-        std::cout << "Successfully attached to tun/tap device " << tunTapDevice << std::endl;
-    } else {
-        std::cerr << "Error allocating tun/tap interface: " << tunFd << std::endl;
-        exit(1);
+	int flags = IFF_TAP | IFF_NO_PI;
+    if (tunQueueCount > 1) {
+        flags |= IFF_MULTI_QUEUE;
+    }
+    if (tunVnetHdr) {
+        flags |= IFF_VNET_HDR;
     }
 
+    for (unsigned int i = 0; i < tunQueueCount; i++) {
+        int fd = allocateTunDevice(tunName, flags);
+        if (fd >= 0 && tunVnetHdr && !enableTunOffloads(fd)) {
+            close(fd);
+            fd = -1;
+        }
+        if (fd >= 0) {
+            tunQueueFds.push_back(fd);
+        } else {
+            std::cerr << "Error allocating tun/tap interface queue " << i << ": " << fd << std::endl;
+            exit(1);
+        }
+    }
+
+    tunFd = tunQueueFds[0];
+    std::cout << "Successfully attached to tun/tap device " << tunTapDevice << " with " << tunQueueCount << " queue(s)" << std::endl;
+
     return tunFd;
 }
 
@@ -101,13 +195,14 @@ int allocateTunDevice(char *dev, int flags) {
 
     // try to create the device
     if(ioctl(fd, TUNSETIFF, (void *) &ifr) < 0) {
-        //close(fd);
+        close(fd);
         std::cerr << "Error: enabling TUNSETIFF" << std::endl;
-        return .1;
+        return -1;
     }
 
     //Make interface persistent
     if(ioctl(fd, TUNSETPERSIST, 1) < 0){
+        close(fd);
         std::cerr << "Error: enabling TUNSETPERSIST" << std::endl;
         return -1;
     }
@@ -123,51 +218,109 @@ int allocateTunDevice(char *dev, int flags) {
     return fd;
 }
 
+/**
+* Enable the checksum and segmentation offloads on a TUN/TAP device opened with IFF_VNET_HDR.
+*
+* UFO was removed from newer kernels, so the TSO offloads are enabled without it if needed.
+*
+* @param fd The file descriptor of the TUN/TAP device
+* @return True if the offloads were enabled
+*/
+bool enableTunOffloads(int fd) {
+    int hdrSize = sizeof(virtio_net_hdr);
+    if (ioctl(fd, TUNSETVNETHDRSZ, &hdrSize) < 0) {
+        std::cerr << "Error: enabling TUNSETVNETHDRSZ" << std::endl;
+        return false;
+    }
+
+    unsigned int offloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+    if (ioctl(fd, TUNSETOFFLOAD, offloads | TUN_F_UFO) < 0 && ioctl(fd, TUNSETOFFLOAD, offloads) < 0) {
+        std::cerr << "Error: enabling TUNSETOFFLOAD" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 /**
 * The thread function in charge receiving and transmitting messages with the radio.
 * The received messages from RF24Network and NRF24L01 device and enqueued in the rxQueue and forwaded to the TUN/TAP device.
 * The messages from the TUN/TAP device (in the txQueue) are sent to the RF24Network lib and transmited over the air.
+* The time of every loop iteration without the blocking sends and the planned idle sleep is recorded in radioLoopJitter,
+* so it shows the scheduling latency and the receive work. The duration of every send is recorded in radioTxTime.
 *
 * @note Optimization: Use two thread for rx and tx with the radio, but thread synchronisation and semaphores are needed.
 *       It may increase the throughput.
 */
 void radioRxTxThreadFunction() {
 
+    uint64_t lastIteration = 0;
+    uint64_t excludedNanos = 0;  // sends and idle sleep of the last iteration
+
+    if (rtProfile) {
+        // touch the stack now, not when the first big frame arrives
+        volatile uint8_t stackPrefault[64 * 1024];
+        for (std::size_t i = 0; i < sizeof(stackPrefault); i += 4096) {
+            stackPrefault[i] = 0;
+        }
+    }
+
     while(1) {
     try {
 
-        network.update();
+        boost::this_thread::interruption_point();
+
+        uint64_t now = getMonotonicNanos();
+        if (lastIteration != 0) {
+            uint64_t elapsed = now - lastIteration;
+            radioLoopJitter.record((elapsed > excludedNanos) ? (elapsed - excludedNanos) / 1000 : 0);
+        }
+        lastIteration = now;
+        bool busy = false;
+
+        if (!radioSimulated) {
+            network.update();
+        }
 
          //RX section
          
-        while ( network.available() ) { // Is there anything ready for us?
+        while ( !radioSimulated && network.available() ) { // Is there anything ready for us?
 
+            busy = true;
             RF24NetworkHeader header;        // If so, grab it and print it out
-            Message msg;
             uint8_t buffer[MAX_PAYLOAD_SIZE];
 
             unsigned int bytesRead = network.read(header,buffer,MAX_PAYLOAD_SIZE);
             if (bytesRead > 0) {
-                msg.setPayload(buffer,bytesRead);
-                if (PRINT_DEBUG >= 1) {
-                    std::cout << "Radio: Received "<< bytesRead << " bytes ... " << std::endl;
-                }
-                if (PRINT_DEBUG >= 3) {
-                    printPayload(msg.getPayloadStr(),"radio RX");
-                }
-                radioRxQueue.push(msg);
+                receiveRadioFrame(header.from_node, buffer, bytesRead);
             } else {
                 std::cerr << "Radio: Error reading data from radio. Read '" << bytesRead << "' Bytes." << std::endl;
             }
         } //End RX
 
-        network.update();
+        while ( radioSimulated && !simRadioRxQueue.empty() ) {
+
+            busy = true;
+            Message msg = simRadioRxQueue.pop();
+            uint16_t fromNode = otherNodeAddr;
+            if (msg.getLength() >= 12) {
+                getNodeFromMac(msg.getPayload() + 6, fromNode);
+            }
+            receiveRadioFrame(fromNode, msg.getPayload(), msg.getLength());
+        }
+
+        if (!radioSimulated) {
+            network.update();
+        }
 
 
          // TX section
         
-        while(!radioTxQueue.empty() && !radio.available() ) {
-            Message msg = radioTxQueue.pop();
+        uint64_t txStart = getMonotonicNanos();
+        Message msg;
+        while(!radioRxPending() && popRadioTx(msg)) {
+
+            busy = true;
 
             if (PRINT_DEBUG >= 1) {
                 std::cout << "Radio: Sending "<< msg.getLength() << " bytes ... ";
@@ -191,7 +344,7 @@ void radioRxTxThreadFunction() {
 			
 			tmp = msg.getPayload();
 			
-			uint32_t RF24_STR = 0x34324652; //Identifies the mac as an RF24 mac
+			uint32_t RF24_STR = RF24_MAC_VERIFICATION; //Identifies the mac as an RF24 mac
 			uint32_t ARP_BC = 0xFFFFFFFF;   //Broadcast address
 			struct macStruct{
 				uint16_t rf24_Addr;
@@ -210,17 +363,17 @@ void radioRxTxThreadFunction() {
 			if(macData.rf24_Verification == RF24_STR){
 				const uint16_t other_node = macData.rf24_Addr;			
 				RF24NetworkHeader header(/*to node*/ other_node, EXTERNAL_DATA_TYPE);
-				ok = network.write(header,msg.getPayload(),msg.getLength());
+				ok = radioWrite(header, msg, false);
 				printf("*************W1\n");
 			}else
-			if(macData.rf24_Verification == ARP_BC){
+			if(macData.rf24_Verification == ARP_BC || (tmp[0] & 0x01)){ // broadcast, or multicast let through by the filter
 				const uint16_t other_node = otherNodeAddr;			
 				RF24NetworkHeader header(/*to node*/ 00, EXTERNAL_DATA_TYPE); //Set to master node, will be modified by RF24Network if multi-casting
 				
 				if(thisNodeAddr == 00){ //Master Node
-					ok = network.multicast(header,msg.getPayload(),msg.getLength(),1 ); //Send to Level 1
+					ok = radioWrite(header, msg, true); //Send to Level 1
 				}else{
-					ok = network.write(header,msg.getPayload(),msg.getLength());
+					ok = radioWrite(header, msg, false);
 				}
 				printf("*****************W2\n");
 			}
@@ -233,6 +386,14 @@ void radioRxTxThreadFunction() {
                 std::cerr << "failed." << std::endl;
             }
         } //End Tx
+        excludedNanos = getMonotonicNanos() - txStart;
+
+        if ((rtProfile || radioSimulated) && !busy) {
+            // give the CPU away for a moment, a SCHED_FIFO busy loop would starve the system
+            // only the oversleep is scheduling latency
+            excludedNanos += RT_IDLE_SLEEP_US * 1000ULL;
+            boost::this_thread::sleep(boost::posix_time::microseconds(RT_IDLE_SLEEP_US));
+        }
 
     } catch(boost::thread_interrupted&) {
         std::cerr << "radioRxThreadFunction is stopped" << std::endl;
@@ -242,35 +403,488 @@ void radioRxTxThreadFunction() {
 }
 
 /**
-* Thread function in charge of reading, framing and enqueuing the packets from the TUN/TAP interface in the RxQueue.
+* Handle a frame received from the radio: learn the sender, relay it or queue it for the TUN/TAP device.
+*
+* @param fromNode The RF24Network node the frame was received from
+* @param buffer The frame
+* @param len The length of the frame
+*/
+void receiveRadioFrame(uint16_t fromNode, uint8_t *buffer, unsigned int len) {
+    Message msg;
+    msg.setPayload(buffer,len);
+    packetCapture.capture(CAPTURE_RADIO_RX, buffer, len);
+
+    if (PRINT_DEBUG >= 1) {
+        std::cout << "Radio: Received "<< len << " bytes ... " << std::endl;
+    }
+    if (PRINT_DEBUG >= 3) {
+        printPayload(msg.getPayloadStr(),"radio RX");
+    }
+    learnNeighbour(buffer, len);
+    if (!relayToRadio(msg, fromNode)) {
+        radioRxQueue.push(msg);
+    }
+}
+
+/**
+* Check if the radio has received frames waiting to be read.
+*
+* @return True if the (real or simulated) radio has frames available
+*/
+bool radioRxPending() {
+    if (radioSimulated) {
+        return !simRadioRxQueue.empty();
+    }
+    return radio.available();
+}
+
+/**
+* Send a message over the air, or through the simulated radio.
+*
+* The simulated radio takes SIM_FRAME_AIRTIME_US for every radio frame RF24Network would fragment the message into.
+*
+* @param header The RF24Network header with the destination node
+* @param msg The message
+* @param multicast Multicast to the first level instead of sending to the header node
+* @return True if the message was sent
+*/
+bool radioWrite(RF24NetworkHeader &header, Message &msg, bool multicast) {
+    packetCapture.capture(CAPTURE_RADIO_TX, msg.getPayload(), msg.getLength());
+
+    if (!radioSimulated) {
+        uint64_t start = getMonotonicNanos();
+        bool ok;
+        if (multicast) {
+            ok = network.multicast(header,msg.getPayload(),msg.getLength(),1 );
+        } else {
+            ok = network.write(header,msg.getPayload(),msg.getLength());
+        }
+        radioTxTime.record((getMonotonicNanos() - start) / 1000);
+        return ok;
+    }
+
+    if (msg.getLength() > MAX_PAYLOAD_SIZE) {
+        return false;
+    }
+    std::size_t frameData = MAX_FRAME_SIZE - sizeof(RF24NetworkHeader);
+    std::size_t frames = (msg.getLength() + frameData - 1) / frameData;
+    simRadioFrames += frames;
+    simRadioBytes += msg.getLength();
+    boost::this_thread::sleep(boost::posix_time::microseconds(frames * SIM_FRAME_AIRTIME_US));
+    return true;
+}
+
+/**
+* Get the RF24Network address encoded in a MAC address.
+*
+* @param mac The 6 Bytes of the MAC address
+* @param node Set to the node address if the MAC is an RF24 MAC
+* @return True if the MAC is an RF24 MAC
+*/
+bool getNodeFromMac(const uint8_t *mac, uint16_t &node) {
+    uint32_t verification;
+    memcpy(&verification, mac + 2, 4);
+    if (verification != RF24_MAC_VERIFICATION) {
+        return false;
+    }
+    memcpy(&node, mac, 2);
+    return true;
+}
+
+/**
+* Write the RF24 MAC address of a node.
+*
+* @param mac The 6 Bytes to write the MAC address to
+* @param node The RF24Network address of the node
+*/
+void setMacFromNode(uint8_t *mac, uint16_t node) {
+    uint32_t verification = RF24_MAC_VERIFICATION;
+    memcpy(mac, &node, 2);
+    memcpy(mac + 2, &verification, 4);
+}
+
+/**
+* Learn the IPv4 address of the node which sent the given frame.
+*
+* @param frame The ethernet frame received from the radio
+* @param len The length of the frame
+*/
+void learnNeighbour(const uint8_t *frame, std::size_t len) {
+    uint16_t node;
+    uint32_t ip;
+
+    if (len < ETH_HDR_LEN || !getNodeFromMac(frame + 6, node)) {
+        return;
+    }
+
+    int etherType = (frame[12] << 8) | frame[13];
+    if (etherType == ETH_TYPE_IPV4 && len >= ETH_HDR_LEN + 20) {
+        memcpy(&ip, frame + ETH_HDR_LEN + 12, 4); // source address
+    } else if (etherType == ETH_TYPE_ARP && len >= ETH_HDR_LEN + 28) {
+        memcpy(&ip, frame + ETH_HDR_LEN + 14, 4); // sender protocol address
+    } else {
+        return;
+    }
+
+    neighbours.learn(ip, node, getMonotonicNanos() / 1000000);
+}
+
+/**
+* Master relay fast path.
+*
+* Frames received from the radio addressed to another radio node are queued for the radio directly
+* instead of taking the round trip through the TUN/TAP device and the kernel.
+* IPv4 packets addressed to our MAC and routed to another radio node are forwarded as the kernel would:
+* the MACs are rewritten and the TTL is decremented. Packets with an expiring TTL are left to the kernel.
+*
+* The routed IPv4 forwarding is opt-in (relayRoutedIp) and only used if the kernel forwards IPv4 on the TUN/TAP device.
+*
+* @note The kernel firewall is not applied to the relayed frames. Disable relayFastPath if it is needed.
+*
+* @param msg The message received from the radio
+* @param fromNode The RF24Network node the message was received from
+* @return True if the message was relayed (or dropped) and must not be written to the TUN/TAP device
+*/
+bool relayToRadio(Message &msg, uint16_t fromNode) {
+
+    if (thisNodeAddr != 00 || !relayFastPath || msg.getLength() < ETH_HDR_LEN) {
+        return false;
+    }
+
+    uint8_t *frame = msg.getPayload();
+    uint16_t toNode;
+
+    if (!getNodeFromMac(frame, toNode)) {
+        return false; // broadcast or not for the mesh
+    }
+
+    if (toNode == fromNode) {
+        return false; // never bounce a frame back to its sender
+    }
+
+    if (toNode == thisNodeAddr) {
+        // addressed to us, relay only if the kernel would route it to another radio node
+        int etherType = (frame[12] << 8) | frame[13];
+        if (!relayRoutedIp || etherType != ETH_TYPE_IPV4 || msg.getLength() < ETH_HDR_LEN + 20) {
+            return false;
+        }
+
+        uint8_t *ip = frame + ETH_HDR_LEN;
+        uint32_t dstIp;
+        memcpy(&dstIp, ip + 16, 4);
+        if (ip[8] <= 1 || !neighbours.lookup(dstIp, toNode, getMonotonicNanos() / 1000000) ||
+            toNode == thisNodeAddr || toNode == fromNode) {
+            return false;
+        }
+
+        setMacFromNode(frame, toNode);
+        setMacFromNode(frame + 6, thisNodeAddr);
+
+        // decrement the TTL and update the header checksum incrementally (RFC 1624)
+        ip[8]--;
+        uint32_t sum = ((ip[10] << 8) | ip[11]) + 0x0100;
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        ip[10] = sum >> 8;
+        ip[11] = sum & 0xFF;
+    }
+
+    if (radioTxQueue.size() < MAX_TX_QUEUE_SIZE) {
+        radioTxQueue.push(msg);
+        relayedPackets++;
+        if (PRINT_DEBUG >= 1) {
+            std::cout << "Radio: Relaying " << msg.getLength() << " bytes from node " << std::oct << fromNode
+                      << " to node " << toNode << std::dec << std::endl;
+        }
+    } else {
+        relayDroppedPackets++;
+    }
+
+    return true;
+}
+
+/**
+* Check if the kernel forwards IPv4 on an interface (net.ipv4.conf.<if>.forwarding).
+*
+* @param ifName The interface name
+* @return True if forwarding is enabled
+*/
+bool kernelForwardsIpv4(const char *ifName) {
+    std::ifstream file((std::string("/proc/sys/net/ipv4/conf/") + ifName + "/forwarding").c_str());
+    int forwarding = 0;
+    return file >> forwarding && forwarding != 0;
+}
+
+/**
+* Per packet processing of a frame read from the TUN/TAP interface.
+*
+* Called in parallel by the queue workers, so it must only use thread safe state.
+*
+* @param buffer The frame read from the TUN/TAP interface
+* @param nread The length of the frame
+* @param out The messages to be sent over the air are appended
+*/
+void processTunFrame(uint8_t *buffer, std::size_t nread, uint64_t nowMs, std::vector<Message> &out) {
+
+    std::size_t first = out.size();
+
+    if (tunVnetHdr) {
+        virtio_net_hdr vnetHdr;
+        if (nread < sizeof(vnetHdr)) {
+            return;
+        }
+        memcpy(&vnetHdr, buffer, sizeof(vnetHdr));
+
+        // segment super packets and complete partial checksums, the kernel left that to us
+        if (!GsoSegmenter::segment(buffer + sizeof(vnetHdr), nread - sizeof(vnetHdr), vnetHdr, MAX_PAYLOAD_SIZE,
+                                   MAX_FRAME_SIZE - sizeof(RF24NetworkHeader), out)) {
+            std::cerr << "Tun: Dropping packet with unsupported offload, gso type " << (int)vnetHdr.gso_type << std::endl;
+            return;
+        }
+    } else {
+        // copy received data into new Message
+        Message msg;
+        msg.setPayload(buffer,nread);
+        out.push_back(msg);
+    }
+
+    // capture what the radio would get, so a replay needs no offload support
+    std::size_t kept = first;
+    for (std::size_t i = first; i < out.size(); i++) {
+        packetCapture.capture(CAPTURE_TUN_READ, out[i].getPayload(), out[i].getLength());
+
+        // drop broadcast noise before it takes a slot in the tx queue
+        if (!broadcastFilter.accept(out[i].getPayload(), out[i].getLength(), nowMs)) {
+            if (PRINT_DEBUG >= 2) {
+                std::cout << "Tun: Broadcast frame filtered" << std::endl;
+            }
+            continue;
+        }
+        if (kept != i) {
+            out[kept] = out[i];
+        }
+        kept++;
+    }
+    out.resize(kept);
+}
+
+/**
+* Queue a processed frame for the radio.
+*
+* With a single queue the frame goes to the radioTxQueue, otherwise to the worker ring of the queue.
+*
+* @param msg The message to send over the air
+* @param queue The index of the TUN/TAP queue the frame was read from
+* @return False if the queue is full and the frame was not queued
+*/
+bool queueRadioTx(const Message &msg, unsigned int queue) {
+    if (workerTxRings.empty()) {
+        if (radioTxQueue.size() >= MAX_TX_QUEUE_SIZE) {
+            return false;
+        }
+        radioTxQueue.push(msg);
+        return true;
+    }
+    return workerTxRings[queue]->push(msg);
+}
+
+bool queueRadioTxPacket(const std::vector<Message> &frames, unsigned int queue, bool wait) {
+    for (std::size_t i = 0; i < frames.size(); i++) {
+        while (!queueRadioTx(frames[i], queue)) {
+            if (i == 0 && !wait) {
+                return false;
+            }
+            boost::this_thread::sleep(boost::posix_time::microseconds(RT_IDLE_SLEEP_US));
+        }
+    }
+    return true;
+}
+
+/**
+* Get the next message to send over the air.
+*
+* Relayed frames in the radioTxQueue go first, then the worker rings are served round robin.
+* Must only be called from the radio thread.
+*
+* @param msg Set to the next message
+* @return False if there is nothing to send
+*/
+bool popRadioTx(Message &msg) {
+    static std::size_t nextSource = 0;
+    std::size_t sources = workerTxRings.size() + 1; // the last source is the radioTxQueue
+
+    for (std::size_t i = 0; i < sources; i++) {
+        std::size_t source = (nextSource + i) % sources;
+        if (source == workerTxRings.size()) {
+            if (radioTxQueue.empty()) {
+                continue;
+            }
+            msg = radioTxQueue.pop();
+        } else if (!workerTxRings[source]->pop(msg)) {
+            continue;
+        }
+        nextSource = source + 1;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+* Pin a thread to a CPU core.
+*
+* @param thread The thread to pin
+* @param core The core number, modulo the number of online cores
+*/
+void pinThreadToCore(boost::thread &thread, unsigned int core) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        cores = 1;
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core % cores, &cpuSet);
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet) != 0) {
+        std::cerr << "Error: pinning thread to core " << core % cores << std::endl;
+    }
+}
+
+/**
+* Get the core of a TUN/TAP thread.
+*
+* With the real-time profile the core of the radio thread is skipped.
+*
+* @param index The index of the thread
+* @return The core number
+*/
+unsigned int getTunCore(unsigned int index) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!rtProfile || cores < 2) {
+        return index;
+    }
+
+    unsigned int radioCore = (rtRadioCpu < 0) ? cores - 1 : rtRadioCpu % cores;
+    unsigned int core = index % (cores - 1);
+    return (core >= radioCore) ? core + 1 : core;
+}
+
+/**
+* Apply the process wide part of the real-time profile.
+*
+* All current and future memory is locked, malloc is told to keep freed memory and some heap is prefaulted,
+* so the radio thread does not take page faults later on.
+*/
+void applyRealtimeProfile() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "Error: mlockall failed, memory is not locked" << std::endl;
+    }
+
+    mallopt(M_TRIM_THRESHOLD, -1);  // never give memory back to the system
+    mallopt(M_MMAP_MAX, 0);  // serve all allocations from the locked heap
+
+    uint8_t *prefault = (uint8_t *)malloc(RT_PREFAULT_SIZE);
+    if (prefault != NULL) {
+        memset(prefault, 0, RT_PREFAULT_SIZE);
+        free(prefault);
+    }
+}
+
+/**
+* Run a thread with SCHED_FIFO pinned to a core.
+*
+* @param thread The thread
+* @param core The core number
+* @param priority The SCHED_FIFO priority
+*/
+void setRealtimeScheduling(boost::thread &thread, unsigned int core, int priority) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    if (pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) != 0) {
+        std::cerr << "Error: setting SCHED_FIFO priority " << priority << std::endl;
+    }
+    pinThreadToCore(thread, core);
+}
+
+/**
+* Keep a thread away from the core of the radio thread.
+*
+* @param thread The thread
+*/
+void isolateFromRadioCore(boost::thread &thread) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 2) {
+        return;
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (long i = 0; i < cores; i++) {
+        CPU_SET(i, &cpuSet);
+    }
+    CPU_CLR((rtRadioCpu < 0) ? cores - 1 : rtRadioCpu % cores, &cpuSet);
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet), &cpuSet) != 0) {
+        std::cerr << "Error: isolating thread from the radio core" << std::endl;
+    }
+}
+
+/**
+* Signal handler for SIGUSR1 requesting a report of the radio loop jitter.
 *
+* @param sig The signal number
+*/
+void onJitterReportSignal(int sig) {
+    (void)sig;
+    jitterReportRequested = 1;
+}
+
+/**
+* Thread function in charge of reading, framing and enqueuing the packets from one TUN/TAP queue.
+*
+* With a single queue the frames are enqueued in the radioTxQueue, otherwise in the worker ring of the queue.
 * This thread uses "select()" with timeout to avoid a busy waiting
+*
+* @param queue The index of the queue in tunQueueFds
 */
-void tunRxThreadFunction() {
+void tunRxThreadFunction(unsigned int queue) {
 
     fd_set socketSet;
     struct timeval selectTimeout;
     uint8_t buffer[MAX_TUN_BUF_SIZE];
     int nread;
+    int fd = tunQueueFds[queue];
+    std::vector<Message> out;
 
     while(1) {
     try {
 
+        boost::this_thread::interruption_point();
+
         // reset socket set and add tap descriptor
         FD_ZERO(&socketSet);
-        FD_SET(tunFd, &socketSet);
+        FD_SET(fd, &socketSet);
 
         // initialize timeout
         selectTimeout.tv_sec = 1;
         selectTimeout.tv_usec = 0;
 
         // suspend thread until we receive a packet or timeout
-        if (select(tunFd + 1, &socketSet, NULL, NULL, &selectTimeout) != 0) {
-            if (FD_ISSET(tunFd, &socketSet)) {
-                if ((nread = read(tunFd, buffer, MAX_TUN_BUF_SIZE)) >= 0) {
+        int ready = select(fd + 1, &socketSet, NULL, NULL, &selectTimeout);
+
+        // the first reader wakes up at least once a second, report from here and not from the radio thread
+        if (queue == 0 && jitterReportRequested) {
+            jitterReportRequested = 0;
+            radioLoopJitter.print("Radio loop");
+            radioTxTime.print("Radio TX");
+        }
+
+        if (ready > 0) {
+            if (FD_ISSET(fd, &socketSet)) {
+                if ((nread = read(fd, buffer, MAX_TUN_BUF_SIZE)) >= 0) {
 
                     if (PRINT_DEBUG >= 1) {
-                        std::cout << "Tun: Successfully read " << nread  << " bytes from tun device" << std::endl;
+                        std::cout << "Tun: Successfully read " << nread  << " bytes from tun queue " << queue << std::endl;
                     }
                     if (PRINT_DEBUG >= 3) {
                         //printPayload(std::string(buffer, nread),"Tun read");
@@ -281,16 +895,13 @@ void tunRxThreadFunction() {
 						printf("%#x\n",(uint8_t)buffer[i]);
 					}*/
 
-                    // copy received data into new Message
-                    Message msg;
-                    msg.setPayload(buffer,nread);
+                    out.clear();
+                    processTunFrame(buffer, nread, getMonotonicNanos() / 1000000, out);
 
                     // send downwards
-					if(radioTxQueue.size() < 3){
-						radioTxQueue.push(msg);
-					}else{
-					  //std::cout << "Tun Drop" << std::endl;
-					}
+                    if (!queueRadioTxPacket(out, queue, false)) {
+                        tunDroppedPackets++;
+                    }
 
                 } else
                     std::cerr << "Tun: Error while reading from tun/tap interface." << std::endl;
@@ -308,20 +919,48 @@ void tunRxThreadFunction() {
 * This thread function waits for incoming messages from the radio and forwards them to the TUN/TAP interface.
 *
 * This threads blocks until a message is received avoiding busy waiting.
+* With tunVnetHdr consecutive TCP segments already waiting in the radioRxQueue are coalesced into one write.
 */
 void tunTxThreadFunction() {
+    TcpCoalescer coalescer;
+    Message pending;
+    bool hasPending = false;
+
     while(1) {
     try {
         //Wait for Message from radio
-        Message msg = radioRxQueue.pop();
+        Message msg = hasPending ? pending : radioRxQueue.pop();
+        hasPending = false;
 
         assert(msg.getLength() <= MAX_TUN_BUF_SIZE);
 
         if (msg.getLength() > 0) {
 
-            size_t writtenBytes = write(tunFd, msg.getPayload(), msg.getLength());
-			if(!writtenBytes){  writtenBytes = write(tunFd, msg.getPayload(), msg.getLength()); }
-            if (writtenBytes != msg.getLength()) {
+            const uint8_t *data = msg.getPayload();
+            size_t length = msg.getLength();
+
+            if (tunVnetHdr) {
+                // merge the segments of a flow which are already waiting into one super packet
+                coalescer.start(msg);
+                while (coalescer.canGrow() && !radioRxQueue.empty()) {
+                    pending = radioRxQueue.pop();
+                    if (!coalescer.append(pending)) {
+                        hasPending = true;
+                        break;
+                    }
+                }
+                data = coalescer.finish(length);
+            }
+
+            if (tunVnetHdr) {
+                packetCapture.capture(CAPTURE_TUN_WRITE, data + sizeof(virtio_net_hdr), length - sizeof(virtio_net_hdr));
+            } else {
+                packetCapture.capture(CAPTURE_TUN_WRITE, data, length);
+            }
+
+            size_t writtenBytes = write(tunFd, data, length);
+			if(!writtenBytes){  writtenBytes = write(tunFd, data, length); }
+            if (writtenBytes != length) {
                 std::cerr << "Tun: Less bytes written to tun/tap device then requested." << std::endl;
             } else {
                 if (PRINT_DEBUG >= 1) {
@@ -341,6 +980,17 @@ void tunTxThreadFunction() {
     }
 }
 
+/**
+* Get a monotonic timestamp
+*
+* @return Nanoseconds since an arbitrary point in time
+*/
+uint64_t getMonotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /**
 * Debug output of the given message buffer preceeded by the debugMsg.
 *
@@ -369,58 +1019,510 @@ void printPayload(char *buffer, int nread, std::string debugMsg = "") {
     << debugMsg << std::endl
     << "Buffer size: " << nread << " bytes" << std::endl
     << std::hex << std::string(buffer,nread) << std::endl
-    << std::cout << "********************************************************************************" << std::endl;
+    << "********************************************************************************" << std::endl;
 }
 
 /**
-* This procedure is called before terminating the programm to properly close and terminate all the threads and file handlers.
+* Print the command line help.
 *
+* @param prog The name of the program
 */
-void on_exit() {
-    std::cout << "Cleaning up and exiting" << std::endl;
+void printUsage(const char *prog) {
+    std::cout << "Usage: " << prog << " [options]" << std::endl
+    << "  -a, --address ADDR          Address of this node in octal format (0, 01, 021, ...)" << std::endl
+    << "  -o, --other ADDR            Address of the other node (default 01 for the master, 00 otherwise)" << std::endl
+    << "  -C, --channel N             Radio channel (default 97)" << std::endl
+    << "  -c, --config FILE           Config file with one \"option = value\" per line" << std::endl
+    << "  -q, --queues N              Number of TUN/TAP queues and worker threads" << std::endl
+    << "  -v, --vnet-hdr              Segmentation and checksum offload from the kernel" << std::endl
+    << "  -r, --realtime              Real-time profile for the radio thread" << std::endl
+    << "      --rt-priority N         SCHED_FIFO priority of the radio thread" << std::endl
+    << "      --rt-cpu N              Core of the radio thread" << std::endl
+    << "  -n, --no-relay              Disable the relay fast path on the master" << std::endl
+    << "      --relay-routed          Also relay IPv4 routed by the master, if the kernel forwards on the device" << std::endl
+    << "  -s, --state-file FILE       Snapshot file of the learned state, \"\" to disable" << std::endl
+    << "      --snapshot-interval N   Seconds between two snapshots" << std::endl
+    << "      --bc-rate N             Broadcast frames per second" << std::endl
+    << "      --bc-burst N            Broadcast frames sent back to back" << std::endl
+    << "      --bc-dedup-ms N         Deduplication window for broadcasts" << std::endl
+    << "      --bc-drop RULE          Drop broadcasts matching [ipv4/|ipv6/]udp|tcp|icmpv6[:port], repeatable," << std::endl
+    << "                              \"none\" removes the default rules" << std::endl
+    << "      --bc-multicast          Forward multicast frames which are not a full broadcast" << std::endl
+    << "  -w, --capture FILE          Capture the TUN and radio traffic into a pcapng file" << std::endl
+    << "      --capture-slots N       Packets buffered by the capture ring" << std::endl
+    << "      --capture-snaplen N     Bytes captured per packet" << std::endl
+    << "  -p, --replay FILE           Replay a pcapng capture against a simulated radio and exit" << std::endl
+    << "  -x, --replay-speed X        Replay speed, 1 for the original timing, 0 for as fast as possible" << std::endl
+    << "  -h, --help                  Show this help" << std::endl
+    << "Without an address from the options the address is asked for interactively." << std::endl;
+}
 
-    if (tunRxThread) {
-        tunRxThread->interrupt();
-        tunRxThread->join();
+/**
+* Parse an RF24Network node address in octal format (0, 01, 021, ... up to four levels, 05555).
+*
+* @param value The address
+* @param node Set to the node address
+* @return False if the address is not a valid RF24Network address
+*/
+bool parseNodeAddress(const std::string &value, uint16_t &node) {
+    char *end;
+    unsigned long addr = strtoul(value.c_str(), &end, 8);
+    if (value.empty() || *end != '\0' || addr > 07777) {
+        return false;
     }
 
-    if (tunTxThread) {
-        tunTxThread->interrupt();
-        tunTxThread->join();
+    // every octal digit is a level of the tree and must be 1-5
+    for (unsigned long a = addr; a != 0; a >>= 3) {
+        if ((a & 07) < 1 || (a & 07) > 5) {
+            return false;
+        }
     }
 
-    if (radioRxTxThread) {
-        radioRxTxThread->interrupt();
-        radioRxTxThread->join();
+    node = addr;
+    return true;
+}
+
+/**
+* Apply one configuration option, from the command line or the config file.
+*
+* @param name The long option name, '_' and '-' are equivalent
+* @param value The value, "1" for flags
+* @return False if the option or value is invalid
+*/
+bool applyOption(std::string name, const std::string &value) {
+    std::replace(name.begin(), name.end(), '_', '-');
+
+    char *end;
+    unsigned long number = strtoul(value.c_str(), &end, 10);
+    bool isNumber = !value.empty() && *end == '\0';
+    bool flag = value == "1" || value == "yes" || value == "true" || value == "on";
+    bool validFlag = flag || value == "0" || value == "no" || value == "false" || value == "off";
+
+    if (name == "address") {
+        if (!parseNodeAddress(value, thisNodeAddr)) {
+            return false;
+        }
+        nodeAddrSet = true;
+    } else if (name == "other") {
+        return parseNodeAddress(value, otherNodeAddr);
+    } else if (name == "channel" && isNumber && number <= 125) {
+        channel = number;
+    } else if (name == "queues" && isNumber && number >= 1) {
+        tunQueueCount = number;
+    } else if (name == "vnet-hdr" && validFlag) {
+        tunVnetHdr = flag;
+    } else if (name == "realtime" && validFlag) {
+        rtProfile = flag;
+    } else if (name == "rt-priority" && isNumber && number >= 1 && number <= 99) {
+        rtPriority = number;
+    } else if (name == "rt-cpu" && isNumber) {
+        rtRadioCpu = number;
+    } else if (name == "relay" && validFlag) {
+        relayFastPath = flag;
+    } else if (name == "no-relay" && validFlag) {
+        relayFastPath = !flag;
+    } else if (name == "relay-routed" && validFlag) {
+        relayRoutedIp = flag;
+    } else if (name == "state-file") {
+        stateFile = value;
+    } else if (name == "snapshot-interval" && isNumber && number >= 1) {
+        snapshotIntervalS = number;
+    } else if (name == "bc-rate" && isNumber) {
+        bcRateLimit = number;
+    } else if (name == "bc-burst" && isNumber) {
+        bcBurst = number;
+    } else if (name == "bc-dedup-ms" && isNumber) {
+        bcDedupWindowMs = number;
+    } else if (name == "bc-drop") {
+        if (value == "none") {
+            bcDefaultRules = false;
+            bcDropRules.clear();
+            return true;
+        }
+        BroadcastRule rule;
+        if (!parseBroadcastRule(value, rule)) {
+            return false;
+        }
+        bcDropRules.push_back(rule);
+    } else if (name == "bc-multicast" && validFlag) {
+        bcMulticast = flag;
+    } else if (name == "capture") {
+        captureFile = value;
+    } else if (name == "capture-slots" && isNumber && number >= 1) {
+        captureSlots = number;
+    } else if (name == "capture-snaplen" && isNumber && number >= 64 && number <= MAX_TUN_BUF_SIZE) {
+        captureSnaplen = number;
+    } else if (name == "replay") {
+        replayFile = value;
+    } else if (name == "replay-speed") {
+        replaySpeed = strtod(value.c_str(), &end);
+        return !value.empty() && *end == '\0' && replaySpeed >= 0;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Load a config file with one "name = value" option per line. Lines starting with '#' are ignored.
+*
+* @param path The path of the config file
+* @return False if the file could not be read or contains an invalid option
+*/
+bool loadConfigFile(const std::string &path) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        std::cerr << "Error: can not read config file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int lineNo = 1; std::getline(file, line); lineNo++) {
+        std::size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+
+        std::size_t eq = line.find('=');
+        std::string name = line.substr(first, eq == std::string::npos ? std::string::npos : eq - first);
+        std::string value = (eq == std::string::npos) ? "1" : line.substr(eq + 1);
+        name.erase(name.find_last_not_of(" \t\r") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+
+        if (!applyOption(name, value)) {
+            std::cerr << "Error: " << path << ":" << lineNo << ": invalid option '" << name << " = " << value << "'" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+* Parse the command line. A config file given with --config is applied first,
+* so the other command line options override it.
+*
+* @param argc
+* @param **argv
+* @param exitCode Set to the exit code if the program should exit: 0 after --help, 1 after an error
+* @return False if the program should exit
+*/
+bool parseCommandLine(int argc, char **argv, int &exitCode) {
+    static const struct option longOptions[] = {
+        {"address", required_argument, NULL, 'a'},
+        {"other", required_argument, NULL, 'o'},
+        {"channel", required_argument, NULL, 'C'},
+        {"config", required_argument, NULL, 'c'},
+        {"queues", required_argument, NULL, 'q'},
+        {"vnet-hdr", no_argument, NULL, 'v'},
+        {"realtime", no_argument, NULL, 'r'},
+        {"rt-priority", required_argument, NULL, 'P'},
+        {"rt-cpu", required_argument, NULL, 'U'},
+        {"no-relay", no_argument, NULL, 'n'},
+        {"relay-routed", no_argument, NULL, 'T'},
+        {"state-file", required_argument, NULL, 's'},
+        {"snapshot-interval", required_argument, NULL, 'i'},
+        {"bc-rate", required_argument, NULL, 'R'},
+        {"bc-burst", required_argument, NULL, 'B'},
+        {"bc-dedup-ms", required_argument, NULL, 'D'},
+        {"bc-drop", required_argument, NULL, 'F'},
+        {"bc-multicast", no_argument, NULL, 'm'},
+        {"capture", required_argument, NULL, 'w'},
+        {"capture-slots", required_argument, NULL, 'S'},
+        {"capture-snaplen", required_argument, NULL, 'L'},
+        {"replay", required_argument, NULL, 'p'},
+        {"replay-speed", required_argument, NULL, 'x'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    const char *shortOptions = "a:o:C:c:q:vrns:w:p:x:h";
+    int opt;
+    exitCode = 1;
+
+    // first pass: only the config file
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        if (opt == 'h' || opt == '?') {
+            printUsage(argv[0]);
+            exitCode = (opt == 'h') ? 0 : 1;
+            return false;
+        }
+        if (opt == 'c' && !loadConfigFile(optarg)) {
+            return false;
+        }
+    }
+
+    // second pass: everything else
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        if (opt == 'c') {
+            continue;
+        }
+        for (const struct option *o = longOptions; o->name != NULL; o++) {
+            if (o->val == opt && !applyOption(o->name, optarg ? optarg : "1")) {
+                std::cerr << "Error: invalid value for --" << o->name << ": " << (optarg ? optarg : "") << std::endl;
+                return false;
+            }
+        }
+    }
+
+    if (optind < argc) {
+        printUsage(argv[0]);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Restore the learned state from a snapshot.
+*
+* @param state The state loaded from the snapshot file
+*/
+void restoreState(const SnapshotState &state) {
+    uint64_t nowMs = getMonotonicNanos() / 1000000;
+    for (std::size_t i = 0; i < state.neighbours.size(); i++) {
+        neighbours.restore(state.neighbours[i], nowMs);
+    }
+
+    std::cout << "Restored " << neighbours.size() << " neighbours from " << stateFile << std::endl;
+}
+
+/**
+* Save the learned state to the snapshot file.
+*/
+void saveState() {
+    SnapshotState state;
+    state.thisNode = thisNodeAddr;
+    neighbours.getEntries(state.neighbours, getMonotonicNanos() / 1000000);
+
+    if (!stateSnapshot.save(state)) {
+        std::cerr << "Error: saving the state snapshot" << std::endl;
+    }
+}
+
+/**
+* Seed the kernel ARP cache of the TUN/TAP device with the learned neighbours.
+*
+* The RF24 MAC of a node follows from its address, so there is no need to wait for ARP over the air.
+* Errors are ignored, e.g. while the interface is not configured yet.
+*
+* @param entries The learned neighbours
+*/
+void seedKernelArpCache(const std::vector<NeighbourEntry> &entries) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return;
     }
 
-    if (tunFd >= 0)
-        close(tunFd);
+    for (std::size_t i = 0; i < entries.size(); i++) {
+        struct arpreq req;
+        memset(&req, 0, sizeof(req));
+
+        struct sockaddr_in *addr = (struct sockaddr_in *)&req.arp_pa;
+        addr->sin_family = AF_INET;
+        addr->sin_addr.s_addr = entries[i].ip;
+        req.arp_ha.sa_family = ARPHRD_ETHER;
+        setMacFromNode((uint8_t *)req.arp_ha.sa_data, entries[i].node);
+        req.arp_flags = ATF_COM;
+        snprintf(req.arp_dev, sizeof(req.arp_dev), "%s", tunName);
+
+        if (ioctl(fd, SIOCSARP, &req) < 0 && PRINT_DEBUG >= 1) {
+            std::cerr << "Error: seeding the ARP cache for node " << std::oct << entries[i].node << std::dec << std::endl;
+        }
+    }
+
+    close(fd);
 }
 
 /**
-* Projecure to wait and join all the threads.
+* Thread function saving a snapshot of the learned state every snapshotIntervalS seconds.
+*/
+void snapshotThreadFunction() {
+    bool arpSeeded = false;
+
+    while(1) {
+    try {
+        boost::this_thread::sleep(boost::posix_time::seconds(snapshotIntervalS));
+
+        // at startup the interface was probably not configured yet, try again
+        if (!arpSeeded) {
+            std::vector<NeighbourEntry> entries;
+            neighbours.getEntries(entries, getMonotonicNanos() / 1000000);
+            seedKernelArpCache(entries);
+            arpSeeded = true;
+        }
+
+        saveState();
+
+    } catch(boost::thread_interrupted&) {
+        std::cerr << "snapshotThreadFunction is stopped" << std::endl;
+        return;
+    }
+    }
+}
+
+/**
+* Thread function writing the capture ring to the pcapng file every CAPTURE_FLUSH_INTERVAL_MS.
 *
-* @note If an interrupt was not before called, this procedure may block for ever.
+* The data path only copies the packets into the ring, the file I/O happens here.
 */
-void joinThreads() {
-    if (tunRxThread) {
-        tunRxThread->join();
+void captureThreadFunction() {
+    while(1) {
+    try {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(CAPTURE_FLUSH_INTERVAL_MS));
+        packetCapture.flush();
+    } catch(boost::thread_interrupted&) {
+        std::cerr << "captureThreadFunction is stopped" << std::endl;
+        return;
+    }
+    }
+}
+
+/**
+* Thread function replaying a pcapng capture through the pipeline.
+*
+* The packets captured at the TUN read point are processed as if read from the TUN/TAP device, the ones
+* captured at the radio RX point as if received by the radio. The other capture points are outputs and skipped.
+* The original timing is kept, scaled by replaySpeed. With replaySpeed 0 the packets are fed as fast as the
+* pipeline takes them. When the capture is done and the queues are drained the statistics are printed.
+*/
+void replayThreadFunction() {
+    CapturedPacket packet;
+    std::vector<Message> out;
+    unsigned long replayed = 0;
+    unsigned long replayedBytes = 0;
+    unsigned long truncated = 0;
+    uint64_t firstTs = 0;
+    int64_t delayNs = 0;  // offset of the current packet from the first one
+    uint64_t start = getMonotonicNanos();
+
+    try {
+        while (replayReader.next(packet)) {
+            if (packet.interfaceId != CAPTURE_TUN_READ && packet.interfaceId != CAPTURE_RADIO_RX) {
+                continue;
+            }
+            if (packet.data.size() < packet.len || packet.data.empty()) {
+                truncated++; // cut by the snaplen, replaying it would measure something else
+                continue;
+            }
+
+            if (replayed == 0) {
+                firstTs = packet.tsNs;
+                start = getMonotonicNanos();
+            }
+            // never go back in time: packets may be slightly out of order and foreign captures may have clock steps
+            int64_t offset = (int64_t)(packet.tsNs - firstTs);
+            if (offset > delayNs) {
+                delayNs = offset;
+            }
+            // as fast as possible still filters by the original timing
+            uint64_t due = start + (uint64_t)(replaySpeed > 0 ? delayNs / replaySpeed : delayNs);
+            if (replaySpeed > 0) {
+                uint64_t now = getMonotonicNanos();
+                if (due > now) {
+                    boost::this_thread::sleep(boost::posix_time::microseconds((due - now) / 1000));
+                }
+            }
+
+            if (packet.interfaceId == CAPTURE_RADIO_RX) {
+                Message msg;
+                msg.setPayload(&packet.data[0], packet.data.size());
+                simRadioRxQueue.push(msg);
+            } else {
+                out.clear();
+                processTunFrame(&packet.data[0], packet.data.size(), due / 1000000, out);
+                // with the original timing a full queue drops as it would live, otherwise wait for the radio
+                if (!queueRadioTxPacket(out, 0, replaySpeed == 0)) {
+                    tunDroppedPackets++;
+                }
+            }
+            replayed++;
+            replayedBytes += packet.len;
+        }
+
+        // let the pipeline drain before taking the time
+        while (!radioTxQueue.empty() || !simRadioRxQueue.empty() || !radioRxQueue.empty()) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    } catch(boost::thread_interrupted&) {
+        std::cerr << "replayThreadFunction is stopped" << std::endl;
+    }
+
+    double elapsed = (getMonotonicNanos() - start) / 1e9;
+    std::cout << "Replayed " << replayed << " packets, " << replayedBytes << " bytes in " << elapsed << " s";
+    if (elapsed > 0) {
+        std::cout << " (" << replayed / elapsed << " packets/s, " << replayedBytes * 8 / elapsed / 1000 << " kbit/s)";
+    }
+    std::cout << std::endl
+    << "Truncated packets skipped: " << truncated << std::endl
+    << "Dropped before the radio: " << tunDroppedPackets << std::endl
+    << "Simulated radio: " << simRadioFrames << " frames, " << simRadioBytes << " bytes, "
+    << simRadioFrames * SIM_FRAME_AIRTIME_US / 1000 << " ms airtime" << std::endl;
+
+    kill(getpid(), SIGTERM); // done, let main shut down
+}
+
+/**
+* This procedure is called before terminating the programm to properly close and terminate all the threads and file handlers.
+*
+* Registered once the threads are started, main returns on SIGINT or SIGTERM.
+*/
+void on_exit() {
+    std::cout << "Cleaning up and exiting" << std::endl;
+
+    if (replayThread) {
+        replayThread->interrupt();
+        replayThread->join();
+    }
+
+    for (std::size_t i = 0; i < tunRxThreads.size(); i++) {
+        tunRxThreads[i]->interrupt();
+        tunRxThreads[i]->join();
     }
 
     if (tunTxThread) {
+        tunTxThread->interrupt();
         tunTxThread->join();
     }
 
     if (radioRxTxThread) {
+        radioRxTxThread->interrupt();
         radioRxTxThread->join();
     }
+
+    if (snapshotThread) {
+        snapshotThread->interrupt();
+        snapshotThread->join();
+        saveState();
+    }
+    stateSnapshot.close();
+
+    // all taps are stopped, write what is left in the ring
+    if (captureThread) {
+        captureThread->interrupt();
+        captureThread->join();
+        packetCapture.close();
+        std::cout << "Captured packets: " << packetCapture.getCaptured() << ", dropped by the capture ring: " << packetCapture.getDropped() << std::endl;
+    }
+
+    for (std::size_t i = 0; i < tunQueueFds.size(); i++) {
+        close(tunQueueFds[i]);
+    }
+
+    broadcastFilter.printStats();
+    std::cout << "Relayed packets: " << relayedPackets << ", dropped: " << relayDroppedPackets << std::endl;
+    std::cout << "Dropped packets: " << tunDroppedPackets << std::endl;
+    radioLoopJitter.print("Radio loop");
+    radioTxTime.print("Radio TX");
 }
 
 /**
 * Main
 *
-* @TODO better address management
+* The node address comes from the command line or the config file,
+* it is only asked for interactively if neither has it.
 *
 * @param argc
 * @param **argv
@@ -428,7 +1530,41 @@ void joinThreads() {
 */
 int main(int argc, char **argv) {
 
-    std::atexit(on_exit);
+    int exitCode;
+    if (!parseCommandLine(argc, argv, exitCode)) {
+        return exitCode;
+    }
+
+    if (!replayFile.empty()) {
+        if (!replayReader.open(replayFile)) {
+            std::cerr << "Error: can not read the pcapng file " << replayFile << std::endl;
+            exit(1);
+        }
+        // the replay must not touch the hardware or the learned state of the live instance
+        radioSimulated = true;
+        stateFile = "";
+        tunQueueCount = 1;
+        tunVnetHdr = false;
+    }
+
+    SnapshotState savedState;
+    bool haveSavedState = false;
+    if (!stateFile.empty()) {
+        if (stateSnapshot.open(stateFile)) {
+            haveSavedState = stateSnapshot.load(savedState);
+        } else {
+            std::cerr << "Error: can not map the state file " << stateFile << ", starting cold" << std::endl;
+        }
+    }
+
+    if (nodeAddrSet) {
+        if (otherNodeAddr == thisNodeAddr) {
+            otherNodeAddr = (thisNodeAddr == 00) ? 1 : 00;
+        }
+
+        std::cout << "ThisNodeAddress: " << thisNodeAddr << std::endl;
+        std::cout << "OtherNodeAddress: " << otherNodeAddr << std::endl;
+    } else {
 
     std::cout << "\n ************ Address Setup ***********\n";
     std::string input = "";
@@ -463,16 +1599,97 @@ int main(int argc, char **argv) {
             exit(1);
     }
 
+    }
+
+    // the learned state is only valid for the node which saved it
+    if (haveSavedState && savedState.thisNode == thisNodeAddr) {
+        restoreState(savedState);
+    }
+
+    configureBroadcastFilter();
+    if (radioSimulated) {
+        tunFd = open("/dev/null", O_WRONLY);
+        tunQueueFds.push_back(tunFd);
+    } else {
+        configureAndSetUpTunDevice();
+        configureAndSetUpRadio();
+
+        // never forward what the kernel would not route
+        if (relayRoutedIp && !kernelForwardsIpv4(tunName)) {
+            std::cerr << "IPv4 forwarding is disabled on " << tunName << ", relaying routed packets is disabled" << std::endl;
+            relayRoutedIp = false;
+        }
+    }
 
-    configureAndSetUpTunDevice();
-    configureAndSetUpRadio();
+    if (!captureFile.empty()) {
+        if (!packetCapture.open(captureFile, captureSlots, captureSnaplen)) {
+            std::cerr << "Error: can not create the capture file " << captureFile << std::endl;
+            exit(1);
+        }
+        std::cout << "Capturing to " << captureFile << std::endl;
+    }
 
     //start threads
-    tunRxThread.reset(new boost::thread(tunRxThreadFunction));
-    tunTxThread.reset(new boost::thread(tunTxThreadFunction));
-    radioRxTxThread.reset(new boost::thread(radioRxTxThreadFunction));
+    // the rings must exist before any worker starts
+    for (unsigned int i = 0; tunQueueCount > 1 && i < tunQueueCount; i++) {
+        workerTxRings.push_back(boost::shared_ptr< SpscRing< Message > >(new SpscRing< Message >(WORKER_RING_SIZE)));
+    }
+    // SIGINT and SIGTERM are only taken by the main thread below, all threads inherit the mask
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+    std::atexit(on_exit);
+
+    boost::thread::attributes threadAttrs;
+    if (rtProfile) {
+        applyRealtimeProfile();
+        threadAttrs.set_stack_size(RT_THREAD_STACK_SIZE); // the default 8MB stacks would all be locked
+    }
+    signal(SIGUSR1, onJitterReportSignal);
+
+    for (unsigned int i = 0; !radioSimulated && i < tunQueueCount; i++) {
+        tunRxThreads.push_back(boost::shared_ptr< boost::thread >(new boost::thread(threadAttrs, boost::bind(tunRxThreadFunction, i))));
+        if (tunQueueCount > 1) {
+            pinThreadToCore(*tunRxThreads[i], getTunCore(i));
+        } else if (rtProfile) {
+            isolateFromRadioCore(*tunRxThreads[i]);
+        }
+    }
+    tunTxThread.reset(new boost::thread(threadAttrs, tunTxThreadFunction));
+    radioRxTxThread.reset(new boost::thread(threadAttrs, radioRxTxThreadFunction));
+
+    if (rtProfile) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        isolateFromRadioCore(*tunTxThread);
+        setRealtimeScheduling(*radioRxTxThread, (rtRadioCpu < 0) ? cores - 1 : rtRadioCpu, rtPriority);
+    }
+
+    if (!stateFile.empty()) {
+        std::vector<NeighbourEntry> entries;
+        neighbours.getEntries(entries, getMonotonicNanos() / 1000000);
+        seedKernelArpCache(entries);
+        snapshotThread.reset(new boost::thread(threadAttrs, snapshotThreadFunction));
+        if (rtProfile) {
+            isolateFromRadioCore(*snapshotThread);
+        }
+    }
+
+    if (packetCapture.isOpen()) {
+        captureThread.reset(new boost::thread(threadAttrs, captureThreadFunction));
+        if (rtProfile) {
+            isolateFromRadioCore(*captureThread);
+        }
+    }
+
+    if (!replayFile.empty()) {
+        replayThread.reset(new boost::thread(threadAttrs, replayThreadFunction));
+    }
 
-    joinThreads();
+    // wait for a service stop or Ctrl+C, on_exit stops the threads and saves the state
+    int sig;
+    sigwait(&stopSignals, &sig);
 
     return 0;
 }
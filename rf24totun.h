@@ -48,12 +48,33 @@
 #include <iostream>
 #include <iomanip>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <getopt.h>
+#include <fstream>
+#include <algorithm>
+#include <net/if_arp.h>
+#include <vector>
+#include <time.h>
+#include <atomic>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/bind/bind.hpp>
 #include "ThreadSafeQueue.h"
 #include "Message.h"
+#include "BroadcastFilter.h"
+#include "NeighbourTable.h"
+#include "SpscRing.h"
+#include "GsoOffload.h"
+#include "LoopJitter.h"
+#include "StateSnapshot.h"
+#include "PacketCapture.h"
 #include <RF24/RF24.h>
 #include <RF24Network/RF24Network.h>
 
@@ -64,7 +85,7 @@
 	#define IFF_MULTI_QUEUE 0x0100
 #endif
 
-#define MAX_TUN_BUF_SIZE (10 * 1024) // should be enough for now
+#define MAX_TUN_BUF_SIZE (sizeof(virtio_net_hdr) + ETH_HDR_LEN + 40 + 65535) // largest GSO/UFO super packet (IPv6) plus the virtio net header
 
 #ifndef MAX_FRAME_SIZE
     #define MAX_FRAME_SIZE 32   /**<The NRF24L01 frames are only 32Bytes long */
@@ -73,6 +94,40 @@
     #define MAX_PAYLOAD_SIZE 1500 /**<The maximal payload size to be sent over the air. */
 #endif
 
+#define RF24_MAC_VERIFICATION 0x34324652 /**< Bytes 2-5 of a MAC address identifying it as an RF24 MAC ("RF24") */
+
+#define MAX_TX_QUEUE_SIZE 3 /**< Frames from the TUN/TAP interface waiting for the radio before we start dropping */
+#ifndef TUN_QUEUES
+    #define TUN_QUEUES 1 /**< Number of TUN/TAP queues, each read by a worker thread pinned to its own core */
+#endif
+#ifndef TUN_VNET_HDR
+    #define TUN_VNET_HDR 0 /**< Open the TUN/TAP device with IFF_VNET_HDR and the TSO/UFO offloads */
+#endif
+#define WORKER_RING_SIZE 4 /**< Processed frames per TUN/TAP queue worker waiting for the radio */
+
+#ifndef RT_PROFILE
+    #define RT_PROFILE 0 /**< Run the radio thread with SCHED_FIFO on its own core and lock all memory */
+#endif
+#define RT_PRIORITY 50 /**< SCHED_FIFO priority of the radio thread */
+#define RT_RADIO_CPU -1 /**< Core of the radio thread, -1 for the last core */
+#define RT_THREAD_STACK_SIZE (512 * 1024) /**< Thread stack size with the real-time profile, the stacks are locked */
+#define RT_PREFAULT_SIZE (1024 * 1024) /**< Heap prefaulted and kept by malloc with the real-time profile */
+#define RT_IDLE_SLEEP_US 50 /**< Sleep of an idle radio loop iteration, so SCHED_FIFO does not starve the system */
+#define STATE_FILE "/var/tmp/rf24totun.state" /**< Default snapshot file of the learned state, empty to disable */
+#define SNAPSHOT_INTERVAL_S 10 /**< Seconds between two snapshots of the learned state */
+
+#define RT_STALL_THRESHOLD_US 500 /**< Radio loop iterations longer than this are stalls, the 3 frame RX FIFO may overflow */
+#define RT_TX_SLOW_US 100000 /**< Sends taking longer than this are counted as slow, e.g. retries of lost acks */
+
+#define BC_DEDUP_WINDOW_MS 1000 /**< Identical broadcasts within this window are sent only once */
+#define BC_RATE_LIMIT 10 /**< Broadcast frames per second sent over the air */
+#define BC_BURST 20 /**< Broadcast frames which may be sent back to back */
+
+#define CAPTURE_SLOTS 4096 /**< Packets the capture ring holds before it drops */
+#define CAPTURE_SNAPLEN 1600 /**< Bytes captured per packet, coalesced TCP writes are truncated */
+#define CAPTURE_FLUSH_INTERVAL_MS 100 /**< How often the capture ring is written to the pcapng file */
+#define SIM_FRAME_AIRTIME_US 500 /**< Airtime of one 32 Byte frame with auto ack at 1MBPS, for the simulated radio */
+
 /**
  * Radio configuration settings
  */
@@ -81,7 +136,8 @@ RF24 radio(RPI_V2_GPIO_P1_15, RPI_V2_GPIO_P1_24, BCM2835_SPI_SPEED_8MHZ);
 RF24Network network(radio);
 uint16_t thisNodeAddr; /**< Address of our node in Octal format (01,021, etc) */
 uint16_t otherNodeAddr;     /**< Address of the other node */
-const uint8_t channel = 97;
+bool nodeAddrSet;  /**< The address was given on the command line or in the config file */
+uint8_t channel = 97;
 unsigned long packets_sent;  /**< How many have we sent already */
 
 /**
@@ -91,14 +147,79 @@ ThreadSafeQueue< Message > radioRxQueue;
 ThreadSafeQueue< Message > radioTxQueue;
 
 boost::scoped_ptr< boost::thread > radioRxTxThread;
-boost::scoped_ptr< boost::thread > tunRxThread;
+std::vector< boost::shared_ptr< boost::thread > > tunRxThreads;  /**< One reader per TUN/TAP queue */
 boost::scoped_ptr< boost::thread > tunTxThread;
 
+/**
+* Frames processed by the TUN/TAP queue workers, one ring per worker.
+* Only used with more than one queue, otherwise the frames go to the radioTxQueue.
+*/
+std::vector< boost::shared_ptr< SpscRing< Message > > > workerTxRings;
+
+/**
+* Real-time profile and radio loop instrumentation
+*/
+bool rtProfile = RT_PROFILE;
+int rtPriority = RT_PRIORITY;
+int rtRadioCpu = RT_RADIO_CPU;
+LoopJitter radioLoopJitter(RT_STALL_THRESHOLD_US);  /**< Iteration times of the radio loop, without the sends and idle sleeps */
+LoopJitter radioTxTime(RT_TX_SLOW_US);  /**< Duration of the blocking RF24Network sends */
+volatile sig_atomic_t jitterReportRequested;  /**< Set by SIGUSR1 */
+
+/**
+* Broadcast/multicast filtering before the frames reach the air
+*/
+BroadcastFilter broadcastFilter;
+uint32_t bcRateLimit = BC_RATE_LIMIT;
+uint32_t bcBurst = BC_BURST;
+uint32_t bcDedupWindowMs = BC_DEDUP_WINDOW_MS;
+bool bcDefaultRules = true;  /**< Drop the chatty discovery protocols, see configureBroadcastFilter() */
+std::vector< BroadcastRule > bcDropRules;  /**< Additional drop rules from the options */
+bool bcMulticast = false;  /**< Forward multicast frames which are not a full broadcast */
+
+/**
+* Master relay fast path
+*/
+NeighbourTable neighbours;  /**< IPv4 addresses learned from the received frames */
+bool relayFastPath = true;  /**< Forward child to child frames on the master without the kernel round trip */
+bool relayRoutedIp = false;  /**< Also forward IPv4 packets addressed to our MAC but routed to another node, needs kernel forwarding */
+unsigned long relayedPackets;  /**< How many packets were forwarded by the fast path */
+unsigned long relayDroppedPackets;  /**< Relayed packets dropped because the radioTxQueue was full */
+
+/**
+* Warm restart
+*/
+std::string stateFile = STATE_FILE;
+unsigned int snapshotIntervalS = SNAPSHOT_INTERVAL_S;
+StateSnapshot stateSnapshot;
+boost::scoped_ptr< boost::thread > snapshotThread;
+
+/**
+* Packet capture and replay
+*/
+PacketCapture packetCapture;  /**< Taps at the TUN read, radio TX, radio RX and TUN write points */
+std::string captureFile = "";  /**< The pcapng file, empty to disable the capture */
+unsigned int captureSlots = CAPTURE_SLOTS;
+unsigned int captureSnaplen = CAPTURE_SNAPLEN;
+boost::scoped_ptr< boost::thread > captureThread;
+std::string replayFile = "";  /**< A pcapng capture fed through the pipeline instead of the TUN/TAP device and the radio */
+double replaySpeed = 1.0;  /**< Replay speed factor relative to the original timing, 0 for as fast as possible */
+PcapngReader replayReader;
+boost::scoped_ptr< boost::thread > replayThread;
+bool radioSimulated = false;  /**< The radio thread models the airtime instead of using the NRF24L01 */
+ThreadSafeQueue< Message > simRadioRxQueue;  /**< Frames "received" by the simulated radio */
+unsigned long simRadioFrames;  /**< Radio frames sent by the simulated radio */
+unsigned long simRadioBytes;
+std::atomic< unsigned long > tunDroppedPackets;  /**< Packets dropped because the radio could not keep up */
+
 /**
 * TUN/TAP variabled
 */
 char tunName[IFNAMSIZ];
-int tunFd;
+int tunFd;  /**< The first queue, also used to write to the TUN/TAP device */
+unsigned int tunQueueCount = TUN_QUEUES;  /**< Number of TUN/TAP queues, each with its own worker thread */
+std::vector< int > tunQueueFds;
+bool tunVnetHdr = TUN_VNET_HDR;  /**< Segmentation and checksums are done here instead of the kernel */
 
 
 /**
@@ -108,12 +229,33 @@ int tunFd;
 */
 bool configureAndSetUpRadio();
 
+/**
+* Configuration of the broadcast/multicast filter rules.
+*
+* By default the chatty discovery protocols (mDNS, LLMNR, SSDP, NetBIOS, IPv6 router discovery and MLD)
+* are dropped, identical broadcasts are deduplicated and the rest is rate limited.
+* The rules from the bc-drop options are added, "bc-drop = none" removes the default rules.
+*/
+void configureBroadcastFilter();
+
+/**
+* Parse a broadcast drop rule: "[ipv4/|ipv6/]udp|tcp|icmpv6[:port]", e.g. "udp:5353" or "ipv6/icmpv6:133".
+* For ICMPv6 the port is the message type.
+*
+* @param value The rule
+* @param rule Set to the parsed rule
+* @return False if the rule is invalid
+*/
+bool parseBroadcastRule(const std::string &value, BroadcastRule &rule);
+
 /**
 * Configure, set up and allocate the TUN/TAP device.
 *
 * If the TUN/TAP device was allocated successfully the file descriptor is returned.
 * Otherwise the application closes with an error.
-* @note Currently only a TUN device with multi queue is used.
+* With tunQueueCount > 1 the device is opened with IFF_MULTI_QUEUE and one file descriptor per queue is
+* allocated in tunQueueFds. The kernel spreads the packets over the queues by flow hash.
+* @note A persistent device created without IFF_MULTI_QUEUE must be deleted before changing the number of queues.
 *
 * @return The TUN/TAP device file descriptor
 */
@@ -131,10 +273,22 @@ int configureAndSetUpTunDevice();
 */
 int allocateTunDevice(char *dev, int flags);
 
+/**
+* Enable the checksum and segmentation offloads on a TUN/TAP device opened with IFF_VNET_HDR.
+*
+* UFO was removed from newer kernels, so the TSO offloads are enabled without it if needed.
+*
+* @param fd The file descriptor of the TUN/TAP device
+* @return True if the offloads were enabled
+*/
+bool enableTunOffloads(int fd);
+
 /**
 * The thread function in charge receiving and transmitting messages with the radio.
 * The received messages from RF24Network and NRF24L01 device and enqueued in the rxQueue and forwaded to the TUN/TAP device.
 * The messages from the TUN/TAP device (in the txQueue) are sent to the RF24Network lib and transmited over the air.
+* The time of every loop iteration without the blocking sends and the planned idle sleep is recorded in radioLoopJitter,
+* so it shows the scheduling latency and the receive work. The duration of every send is recorded in radioTxTime.
 *
 * @note Optimization: Use two thread for rx and tx with the radio, but thread synchronisation and semaphores are needed.
 *       It may increase the throughput.
@@ -142,32 +296,301 @@ int allocateTunDevice(char *dev, int flags);
 void radioRxTxThreadFunction();
 
 /**
-* Thread function in charge of reading, framing and enqueuing the packets from the TUN/TAP interface in the RxQueue.
+* Handle a frame received from the radio: learn the sender, relay it or queue it for the TUN/TAP device.
+*
+* @param fromNode The RF24Network node the frame was received from
+* @param buffer The frame
+* @param len The length of the frame
+*/
+void receiveRadioFrame(uint16_t fromNode, uint8_t *buffer, unsigned int len);
+
+/**
+* Check if the radio has received frames waiting to be read.
+*
+* @return True if the (real or simulated) radio has frames available
+*/
+bool radioRxPending();
+
+/**
+* Send a message over the air, or through the simulated radio.
+*
+* @param header The RF24Network header with the destination node
+* @param msg The message
+* @param multicast Multicast to the first level instead of sending to the header node
+* @return True if the message was sent
+*/
+bool radioWrite(RF24NetworkHeader &header, Message &msg, bool multicast);
+
+/**
+* Get the RF24Network address encoded in a MAC address.
+*
+* @param mac The 6 Bytes of the MAC address
+* @param node Set to the node address if the MAC is an RF24 MAC
+* @return True if the MAC is an RF24 MAC
+*/
+bool getNodeFromMac(const uint8_t *mac, uint16_t &node);
+
+/**
+* Write the RF24 MAC address of a node.
+*
+* @param mac The 6 Bytes to write the MAC address to
+* @param node The RF24Network address of the node
+*/
+void setMacFromNode(uint8_t *mac, uint16_t node);
+
+/**
+* Learn the IPv4 address of the node which sent the given frame.
+*
+* @param frame The ethernet frame received from the radio
+* @param len The length of the frame
+*/
+void learnNeighbour(const uint8_t *frame, std::size_t len);
+
+/**
+* Master relay fast path.
+*
+* Frames received from the radio addressed to another radio node are queued for the radio directly
+* instead of taking the round trip through the TUN/TAP device and the kernel.
+* IPv4 packets addressed to our MAC and routed to another radio node are forwarded as the kernel would:
+* the MACs are rewritten and the TTL is decremented. Packets with an expiring TTL are left to the kernel.
+*
+* The routed IPv4 forwarding is opt-in (relayRoutedIp) and only used if the kernel forwards IPv4 on the TUN/TAP device.
+*
+* @note The kernel firewall is not applied to the relayed frames. Disable relayFastPath if it is needed.
+*
+* @param msg The message received from the radio
+* @param fromNode The RF24Network node the message was received from
+* @return True if the message was relayed (or dropped) and must not be written to the TUN/TAP device
+*/
+bool relayToRadio(Message &msg, uint16_t fromNode);
+
+/**
+* Check if the kernel forwards IPv4 on an interface (net.ipv4.conf.<if>.forwarding).
+*
+* @param ifName The interface name
+* @return True if forwarding is enabled
+*/
+bool kernelForwardsIpv4(const char *ifName);
+
+/**
+* Per packet processing of a frame read from the TUN/TAP interface.
+*
+* Called in parallel by the queue workers, so it must only use thread safe state.
+* Super packets are segmented first, then every resulting frame is captured and passed
+* through the broadcast filter.
+*
+* @param buffer The frame read from the TUN/TAP interface
+* @param nread The length of the frame
+* @param nowMs The time the frame was read in milliseconds, the trace time during a replay
+* @param out The messages to be sent over the air are appended
+*/
+void processTunFrame(uint8_t *buffer, std::size_t nread, uint64_t nowMs, std::vector<Message> &out);
+
+/**
+* Queue a processed frame for the radio.
+*
+* With a single queue the frame goes to the radioTxQueue, otherwise to the worker ring of the queue.
+*
+* @param msg The message to send over the air
+* @param queue The index of the TUN/TAP queue the frame was read from
+* @return False if the queue is full and the frame was not queued
+*/
+bool queueRadioTx(const Message &msg, unsigned int queue);
+
+/**
+* Queue all frames of one packet read from the TUN/TAP interface.
 *
+* A full queue drops the packet only before its first frame is queued. Once accepted, the
+* remaining frames (the segments of a GSO packet) wait for room, which also holds back the
+* next read from the interface.
+*
+* @param frames The frames processTunFrame() produced from one packet
+* @param queue The index of the TUN/TAP queue the packet was read from
+* @param wait Wait for room for the first frame as well instead of dropping the packet
+* @return False if the packet was dropped
+*/
+bool queueRadioTxPacket(const std::vector<Message> &frames, unsigned int queue, bool wait);
+
+/**
+* Get the next message to send over the air.
+*
+* The worker rings and the radioTxQueue are served round robin, so neither can starve the other.
+* Must only be called from the radio thread.
+*
+* @param msg Set to the next message
+* @return False if there is nothing to send
+*/
+bool popRadioTx(Message &msg);
+
+/**
+* Pin a thread to a CPU core.
+*
+* @param thread The thread to pin
+* @param core The core number, modulo the number of online cores
+*/
+void pinThreadToCore(boost::thread &thread, unsigned int core);
+
+/**
+* Get the core of a TUN/TAP thread.
+*
+* With the real-time profile the core of the radio thread is skipped.
+*
+* @param index The index of the thread
+* @return The core number
+*/
+unsigned int getTunCore(unsigned int index);
+
+/**
+* Apply the process wide part of the real-time profile.
+*
+* All current and future memory is locked, malloc is told to keep freed memory and some heap is prefaulted,
+* so the radio thread does not take page faults later on.
+*/
+void applyRealtimeProfile();
+
+/**
+* Run a thread with SCHED_FIFO pinned to a core.
+*
+* @param thread The thread
+* @param core The core number
+* @param priority The SCHED_FIFO priority
+*/
+void setRealtimeScheduling(boost::thread &thread, unsigned int core, int priority);
+
+/**
+* Keep a thread away from the core of the radio thread.
+*
+* @param thread The thread
+*/
+void isolateFromRadioCore(boost::thread &thread);
+
+/**
+* Signal handler for SIGUSR1 requesting a report of the radio loop jitter.
+*
+* @param sig The signal number
+*/
+void onJitterReportSignal(int sig);
+
+/**
+* Thread function in charge of reading, framing and enqueuing the packets from one TUN/TAP queue.
+*
+* With a single queue the frames are enqueued in the radioTxQueue, otherwise in the worker ring of the queue.
 * This thread uses "select()" with timeout to avoid a busy waiting
+*
+* @param queue The index of the queue in tunQueueFds
 */
-void tunRxThreadFunction();
+void tunRxThreadFunction(unsigned int queue);
 
 /**
 * This thread function waits for incoming messages from the radio and forwards them to the TUN/TAP interface.
 *
 * This threads blocks until a message is received avoiding busy waiting.
+* With tunVnetHdr consecutive TCP segments already waiting in the radioRxQueue are coalesced into one write.
 */
 void tunTxThreadFunction();
 
 /**
-* Projecure to wait and join all the threads.
+* Thread function writing the capture ring to the pcapng file every CAPTURE_FLUSH_INTERVAL_MS.
+*
+* The data path only copies the packets into the ring, the file I/O happens here.
+*/
+void captureThreadFunction();
+
+/**
+* Thread function replaying a pcapng capture through the pipeline.
+*
+* The packets captured at the TUN read point are processed as if read from the TUN/TAP device, the ones
+* captured at the radio RX point as if received by the radio. The other capture points are outputs and skipped.
+* The original timing is kept, scaled by replaySpeed. With replaySpeed 0 the packets are fed as fast as the
+* pipeline takes them. When the capture is done and the queues are drained the statistics are printed.
+*/
+void replayThreadFunction();
+
+/**
+* Print the command line help.
 *
-* @note If an interrupt was not before called, this procedure may block for ever.
+* @param prog The name of the program
 */
-void joinThreads();
+void printUsage(const char *prog);
+
+/**
+* Parse an RF24Network node address in octal format (0, 01, 021, ...).
+*
+* @param value The address
+* @param node Set to the node address
+* @return False if the address is not a valid RF24Network address
+*/
+bool parseNodeAddress(const std::string &value, uint16_t &node);
+
+/**
+* Apply one configuration option, from the command line or the config file.
+*
+* @param name The long option name, '_' and '-' are equivalent
+* @param value The value, "1" for flags
+* @return False if the option or value is invalid
+*/
+bool applyOption(std::string name, const std::string &value);
+
+/**
+* Load a config file with one "name = value" option per line. Lines starting with '#' are ignored.
+*
+* @param path The path of the config file
+* @return False if the file could not be read or contains an invalid option
+*/
+bool loadConfigFile(const std::string &path);
+
+/**
+* Parse the command line. A config file given with --config is applied first,
+* so the other command line options override it.
+*
+* @param argc
+* @param **argv
+* @param exitCode Set to the exit code if the program should exit: 0 after --help, 1 after an error
+* @return False if the program should exit
+*/
+bool parseCommandLine(int argc, char **argv, int &exitCode);
+
+/**
+* Restore the learned state from a snapshot.
+*
+* @param state The state loaded from the snapshot file
+*/
+void restoreState(const SnapshotState &state);
+
+/**
+* Save the learned state to the snapshot file.
+*/
+void saveState();
+
+/**
+* Seed the kernel ARP cache of the TUN/TAP device with the learned neighbours.
+*
+* The RF24 MAC of a node follows from its address, so there is no need to wait for ARP over the air.
+* Errors are ignored, e.g. while the interface is not configured yet.
+*
+* @param entries The learned neighbours
+*/
+void seedKernelArpCache(const std::vector<NeighbourEntry> &entries);
+
+/**
+* Thread function saving a snapshot of the learned state every snapshotIntervalS seconds.
+*/
+void snapshotThreadFunction();
 
 /**
 * This procedure is called before terminating the programm to properly close and terminate all the threads and file handlers.
 *
+* Registered once the threads are started, main returns on SIGINT or SIGTERM.
 */
 void on_exit();
 
+/**
+* Get a monotonic timestamp
+*
+* @return Nanoseconds since an arbitrary point in time
+*/
+uint64_t getMonotonicNanos();
+
 /**
 * Debug output of the given message buffer preceeded by the debugMsg.
 *